@@ -11,6 +11,10 @@
 #define CAM_BASE_HEIGHT 1.7
 #define CAMERA_LOCK PI4 * 0.99
 #define HORIZONTAL_CAMERA_LOCK PI2 * 0.8
+#define BENCHMARK 0
+#define TEXTURE_STATS 0
+#define FRAME_STATS 0
+#define SHADER_STATS 0
 
 void handle_inputs(GLFWwindow*);
 
@@ -47,37 +51,55 @@ f32 devil_rotate[5] = { PI2 + PI4, PI2 + PI4, PI4, PI4 * 3, PI4 };
 void main() {
   canvas_init(&cam, (CanvasInitConfig) { "Room", 1, FULLSCREEN, SCREEN_SIZE });
 
+  if (BENCHMARK) {
+    model_bench("obj", MODEL_PARSE_THREADS);
+    model_bench_cache("obj");
+    canvas_bench_images("img");
+    canvas_bench_textures("img");
+    canvas_bench_mips("img");
+    canvas_bench_batch("img");
+    glfwTerminate();
+    return;
+  }
+
   u32 lowres_fbo = canvas_create_FBO(cam.width * UPSCALE, cam.height * UPSCALE, GL_NEAREST, GL_NEAREST);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-  Model* hud   = model_create("obj/hud.obj",   1,    NULL);
-  Model* walls = model_create("obj/walls.obj", 1e-2, &m_walls);
-  Model* floor = model_create("obj/floor.obj", 1e-2, &m_floor);
-  Model* grids = model_create("obj/grids.obj", 1e-2, &m_grids);
-  Model* body  = model_create("obj/body.obj",  4e-3, &m_body);
-
-  Model* head  = model_create("obj/head.obj",  4e-3, &m_head);
-
-  canvas_create_texture(GL_TEXTURE0, "img/w.ppm",           TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE1, "img/b.ppm",           TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE2, "img/floor.ppm",       TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE3, "img/walls.ppm",       TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE4, "img/grids.ppm",       TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE5, "img/lighter-off.ppm", TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE6, "img/lighter-on.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE7, "img/body.ppm",        TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE8, "img/head.ppm",        TEXTURE_DEFAULT);
-
-  shader = shader_create_program("shd/obj.v", "shd/obj.f");
-
-  canvas_set_pnt_lig(shader, light, 0);
-  canvas_set_pnt_lig(shader, fire,  1);
-  generate_proj_mat(&cam, shader);
-  generate_view_mat(&cam, shader);
-  canvas_uni3f(shader, "PNT_LIGS[1].COL", 0, 0, 0);
+  Model* hud   = model_create("obj/hud.obj",   1,    NULL,     MODEL_DEFAULT);
+  Model* walls = model_create("obj/walls.obj", 1e-2, &m_walls, MODEL_DEFAULT);
+  Model* floor = model_create("obj/floor.obj", 1e-2, &m_floor, MODEL_DEFAULT);
+  Model* grids = model_create("obj/grids.obj", 1e-2, &m_grids, MODEL_DEFAULT);
+  Model* body  = model_create("obj/body.obj",  4e-3, &m_body,  MODEL_DEFAULT);
+
+  Model* head  = model_create("obj/head.obj",  4e-3, &m_head,  MODEL_DEFAULT);
+
+  BatchTexture batch[] = {
+    { GL_TEXTURE0, "img/w.ppm",           TEXTURE_DEFAULT },
+    { GL_TEXTURE1, "img/b.ppm",           TEXTURE_DEFAULT },
+    { GL_TEXTURE2, "img/floor.ppm",       TEXTURE_DEFAULT },
+    { GL_TEXTURE3, "img/walls.ppm",       TEXTURE_DEFAULT },
+    { GL_TEXTURE4, "img/grids.ppm",       TEXTURE_DEFAULT },
+    { GL_TEXTURE5, "img/lighter-off.ppm", TEXTURE_DEFAULT },
+    { GL_TEXTURE6, "img/lighter-on.ppm",  TEXTURE_DEFAULT },
+    { GL_TEXTURE7, "img/body.ppm",        TEXTURE_DEFAULT },
+    { GL_TEXTURE8, "img/head.ppm",        TEXTURE_DEFAULT }
+  };
+  TextureRegistry* textures = registry_create(NULL);
+  registry_textures(textures, batch, sizeof(batch) / sizeof(batch[0]), NULL);
+
+  // White is the key of png materials, those texels are discarded and write neither color nor depth
+  shader = shader_create_variants("shd/obj.v", "shd/obj.f", "#define ALPHA_KEY vec3(1)\n");
+
+  canvas_set_pnt_lig(light, 0);
+  canvas_set_pnt_lig(fire,  1);
+  generate_proj_mat(&cam);
+  generate_view_mat(&cam);
+  canvas_set_pnt_lig_col(1, 0, 0, 0);
 
   while (!glfwWindowShouldClose(cam.window)) {
     update_fps(&fps, &tick);
+    if (FRAME_STATS) PRINT("%5.0f fps %4u uniform lookups, uniforms %4u sent %4u skipped, binds %4u made %4u skipped", fps, canvas_frame.uniform_lookups,
+                           canvas_frame.uniforms_issued, canvas_frame.uniforms_skipped, canvas_frame.binds_issued, canvas_frame.binds_skipped);
 
     model_bind(walls, shader);
     model_draw(walls, shader);
@@ -98,7 +120,7 @@ void main() {
     model_draw(head, shader);
 
     if (lighter_active || lighter_anim.stage) {
-      use_screen_space(&cam, shader, 1);
+      use_screen_space(1);
       canvas_set_material(shader, m_hand);
       if (lighter_active && !lighter_anim.stage) canvas_uni1i(shader, "MAT.S_DIF", 6);
       model_bind(hud, shader);
@@ -121,7 +143,7 @@ void main() {
       if (lighter_active || lighter_anim.stage)
         model_draw(hud, shader);
 
-      use_screen_space(&cam, shader, 0);
+      use_screen_space(0);
       u8 ended = 0;
       if (lighter_anim.stage)
         ended = animation_run(&lighter_anim, 3 / fps);
@@ -131,15 +153,15 @@ void main() {
 
     if (fire_anim.stage) {
       if (lighter_active) 
-        canvas_uni3f(shader, "PNT_LIGS[1].COL", 0.2 + (fire.col[0] * fire_anim.pos * 0.8), fire.col[1] * fire_anim.pos, fire.col[2] * fire_anim.pos);
+        canvas_set_pnt_lig_col(1, 0.2 + (fire.col[0] * fire_anim.pos * 0.8), fire.col[1] * fire_anim.pos, fire.col[2] * fire_anim.pos);
       else 
-        canvas_uni3f(shader, "PNT_LIGS[1].COL", fire.col[0] * (1-fire_anim.pos), fire.col[1] * (1-fire_anim.pos), fire.col[2] * (1-fire_anim.pos));
+        canvas_set_pnt_lig_col(1, fire.col[0] * (1-fire_anim.pos), fire.col[1] * (1-fire_anim.pos), fire.col[2] * (1-fire_anim.pos));
       if (fire_anim.stage) animation_run(&fire_anim, 1 / fps);
     }
 
     if (moving || moving_anim.stage) {
       cam.pos[1] = CAM_BASE_HEIGHT + sin(moving_anim.pos * TAU) * 3e-2;
-      generate_view_mat(&cam, shader);
+      generate_view_mat(&cam);
       if (moving && !moving_anim.stage) animation_start(&moving_anim);
       animation_run(&moving_anim, (moving ? 3 : 10) / fps);
     }
@@ -152,6 +174,10 @@ void main() {
     glfwSwapBuffers(cam.window); 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   }
+  if (TEXTURE_STATS) registry_stats(textures);
+  if (SHADER_STATS) shader_cache_stats();
+  registry_destroy(textures);
+  blocks_destroy();
   glfwTerminate();
 }
 
@@ -161,10 +187,9 @@ void handle_inputs(GLFWwindow* window) {
   if (moving) {
     glm_vec3_add(cam.pos, (vec3) { moving * SPEED / fps, 0, 0 },  cam.pos);
     cam.pos[0] = CLAMP(-2, cam.pos[0], 2);
-    generate_view_mat(&cam, shader);
-    canvas_uni3f(shader, "CAM", cam.pos[0], cam.pos[1], cam.pos[2]);
-    canvas_uni3f(shader, "PNT_LIGS[0].POS", cam.pos[0], CAM_BASE_HEIGHT, 2.2);
-    canvas_uni3f(shader, "PNT_LIGS[1].POS", cam.pos[0], CAM_BASE_HEIGHT, 2.2);
+    generate_view_mat(&cam);
+    canvas_set_pnt_lig_pos(0, cam.pos[0], CAM_BASE_HEIGHT, 2.2);
+    canvas_set_pnt_lig_pos(1, cam.pos[0], CAM_BASE_HEIGHT, 2.2);
   }
 
   if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(window, 1);
@@ -192,7 +217,7 @@ void handle_inputs(GLFWwindow* window) {
   glm_vec3_copy((vec3) { cos(cam.yaw - PI2) * cos(cam.pitch), sin(cam.pitch), sin(cam.yaw - PI2) * cos(cam.pitch) }, cam.dir);
   glm_vec3_copy((vec3) { cos(cam.yaw) * cos(cam.pitch), 0, sin(cam.yaw) * cos(cam.pitch) }, cam.rig);
   glm_normalize(cam.rig);
-  generate_view_mat(&cam, shader);
+  generate_view_mat(&cam);
 
   mouse[0] = pos[0];
   mouse[1] = pos[1];
@@ -0,0 +1,97 @@
+// Headless checks of canvas.h, none of them open a window or need GL. Run from the build directory, where the assets are copied,
+// and exit with the number of tests that failed
+
+#include "canvas.h"
+
+// BC1 lands between 29 and 44 dB on the shipped images, the noisiest car being the lowest
+#define TEST_PSNR_FLOOR 28
+
+typedef struct {
+  const c8* name;
+  const c8* dir;
+  const c8* ext;
+  u8 (*check)(const c8* path);
+  u32 failed;
+} Test;
+
+// Chunked parsing on as many threads as the engine ever uses gives the serial vertexes byte for byte
+u8 test_parse(const c8* path) {
+  u32 size, parallel_size;
+  Vertex* serial   = model_parse(path, &size, NULL, NULL, 1, 1);
+  Vertex* parallel = model_parse(path, &parallel_size, NULL, NULL, 1, MODEL_PARSE_THREADS);
+  u8 ok = size == parallel_size && !memcmp(serial, parallel, sizeof(Vertex) * size);
+  if (!ok) PRINT("  %s: %u vertexes serial, %u parallel", path, size, parallel_size);
+  free(serial);
+  free(parallel);
+  return ok;
+}
+
+// Cooked in memory as it's written to .tex, plain and with the key the layers use. The top level against the .ppm
+u8 test_psnr(const c8* path) {
+  TextureConfig keyed = TEXTURE_COMPRESSED;
+  keyed.keyed = 1;
+  memcpy(keyed.key, (u8[]) { 0, 255, 0 }, 3);
+
+  u8 ok = 1;
+  TextureConfig configs[] = { TEXTURE_COMPRESSED, keyed };
+  for (u8 i = 0; i < 2; i++) {
+    Image image = canvas_cook_texture(path, configs[i]);
+    f32 psnr = canvas_texture_psnr(path, image, configs[i]);
+    canvas_free_image(image);
+    if (psnr >= TEST_PSNR_FLOOR) continue;
+    PRINT("  %s%s: %.2f dB", path, i ? " keyed" : "", psnr);
+    ok = 0;
+  }
+  return ok;
+}
+
+// The SIMD passes add the taps in the same order as the scalar ones, so every kernel the CPU has gives the same bytes with either filter
+u8 test_mips(const c8* path) {
+  Image image = canvas_load_image(path);
+  const c8* kernels[] = { "scalar", "sse2", "avx2" };
+  MipSimd best = mip_simd_best();
+  u8 ok = 1;
+  for (MipFilter filter = MIP_BOX; filter <= MIP_KAISER; filter++) {
+    u8 levels;
+    u64 bytes, simd_bytes;
+    u8* reference = mip_chain(image.pixels, 3, image.width, image.height, filter, MIP_SCALAR, &levels, &bytes);
+    for (MipSimd simd = MIP_SCALAR + 1; simd <= best; simd++) {
+      u8* chain = mip_chain(image.pixels, 3, image.width, image.height, filter, simd, &levels, &simd_bytes);
+      u64 diff = simd_bytes != bytes;
+      for (u64 i = 0; !diff && i < bytes; i++) diff += chain[i] != reference[i];
+      free(chain);
+      if (!diff) continue;
+      PRINT("  %s: %s %s differs from scalar", path, filter == MIP_BOX ? "box" : "kaiser", kernels[simd]);
+      ok = 0;
+    }
+    free(reference);
+  }
+  free(image.pixels);
+  return ok;
+}
+
+Test tests[] = {
+  { "parallel parse", "obj", ".obj", test_parse },
+  { "bc1 psnr",       "img", ".ppm", test_psnr  },
+  { "simd mips",      "img", ".ppm", test_mips  },
+};
+
+void test_file(const c8* path, const c8* name, void* data) {
+  Test* test = data;
+  test->failed += !test->check(path);
+}
+
+// Runs the check on every file of the test's kind, finding none fails it too
+u32 test_run(Test test) {
+  u32 files = canvas_each_file(test.dir, test.ext, test_file, &test);
+  if (!files) PRINT("  no %s files in %s", test.ext, test.dir);
+  PRINT("%s %-20s %u/%u files", test.failed || !files ? "FAIL" : "ok  ", test.name, files - test.failed, files);
+  return test.failed || !files;
+}
+
+int main() {
+  u32 failed = 0;
+  for (u32 i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) failed += test_run(tests[i]);
+  PRINT("%u of %u tests failed", failed, (u32) (sizeof(tests) / sizeof(tests[0])));
+  return failed;
+}
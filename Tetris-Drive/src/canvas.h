@@ -1,11 +1,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <glad/glad.h>
 #include <cglm/cglm.h>
+#ifdef CGLM_SSE2_FP
+#include <immintrin.h>
+#endif
 #include <GLFW/glfw3.h>
 
-#define UNI(shd, uni) (glGetUniformLocation(shd, uni))
+#define UNI(shd, uni) (shader_uniform(shd, uni))
 
 #define MIN(x, y) (x < y ? x : y)
 #define MAX(x, y) (x > y ? x : y)
@@ -17,6 +29,8 @@
 #define PRINT(...) { printf(__VA_ARGS__); printf("\n"); }
 #define VEC2_COMPARE(v1, v2) (v1[0] == v2[0] && v1[1] == v2[1])
 #define VEC3_COMPARE(v1, v2) (v1[0] == v2[0] && v1[1] == v2[1] && v1[2] == v2[2])
+#define IS_DIGIT(c) ((u8) ((c) - '0') < 10)
+#define GROW(arr, cap, need) if ((need) > (cap)) { (cap) = MAX((cap) * 2, (need)); (arr) = realloc((arr), sizeof(*(arr)) * (cap)); }
 
 #define PI  3.14159
 #define TAU PI * 2
@@ -26,13 +40,18 @@
 typedef uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef int8_t   i8;
 typedef int16_t  i16;
 typedef int32_t  i32;
+typedef int64_t  i64;
 typedef float    f32;
 typedef double   f64;
 typedef char     c8;
 
+i32 shader_uniform(u32 program, const c8* name);
+u32 shader_program(u32 shader);
+
 // Canvas 
 
 typedef struct {
@@ -50,6 +69,17 @@ typedef struct {
   f32 screen_size;
 } CanvasInitConfig;
 
+// The FRAME block, std140. generate_*_mat and canvas_set_fog fill it, the next draw uploads it
+typedef struct {
+  mat4 view, proj;
+  vec3 cam;
+  f32  fog_dist;
+  vec3 fog_col;
+  f32  pad;
+} FrameBlock;
+
+FrameBlock frame_block = { GLM_MAT4_IDENTITY_INIT, GLM_MAT4_IDENTITY_INIT };
+u8 frame_dirty = 1, frame_screen;
 void canvas_init(Camera* cam, CanvasInitConfig config) {
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -76,46 +106,222 @@ void canvas_init(Camera* cam, CanvasInitConfig config) {
   glm_vec3_copy((vec3) { 1, 0,  0 }, cam->rig);
 }
 
-void generate_proj_mat(Camera* cam, u32 shader) {
+// The matrices are shared by every program through the FRAME block
+void generate_proj_mat(Camera* cam) {
   glm_mat4_identity(cam->proj);
   glm_perspective(cam->fov, (f32) cam->width / cam->height, cam->near, cam->far, cam->proj);
-  glUniformMatrix4fv(UNI(shader, "PROJ"), 1, GL_FALSE, cam->proj[0]);
+  glm_mat4_copy(cam->proj, frame_block.proj);
+  frame_dirty = 1;
 }
 
-void generate_view_mat(Camera* cam, u32 shader) {
+void generate_view_mat(Camera* cam) {
   vec3 target, up;
   glm_cross(cam->rig, cam->dir, up);
   glm_vec3_add(cam->pos, cam->dir, target);
   glm_lookat(cam->pos, target, up, cam->view);
-  glUniformMatrix4fv(UNI(shader, "VIEW"), 1, GL_FALSE, cam->view[0]);
+  glm_mat4_copy(cam->view, frame_block.view);
+  glm_vec3_copy(cam->pos, frame_block.cam);
+  frame_dirty = 1;
 }
 
-void use_screen_space(Camera* cam, u32 shader, u8 use) {
-  if (!use) {
-    glDepthFunc(GL_LESS);
-    glUniformMatrix4fv(UNI(shader, "PROJ"), 1, GL_FALSE, cam->proj[0]);
-    glUniformMatrix4fv(UNI(shader, "VIEW"), 1, GL_FALSE, cam->view[0]);
-    return;
-  }
-  mat4 blank;
-  glm_mat4_identity(blank);
-  glDepthFunc(GL_ALWAYS);
-  glUniformMatrix4fv(UNI(shader, "PROJ"), 1, GL_FALSE, blank[0]);
-  glUniformMatrix4fv(UNI(shader, "VIEW"), 1, GL_FALSE, blank[0]);
+// Screen space is a second copy of FRAME with blank matrices, switching only rebinds it
+void use_screen_space(u8 use) {
+  glDepthFunc(use ? GL_ALWAYS : GL_LESS);
+  frame_screen = use;
+}
+
+// Fragments fade into col up to dist away, 0 turns fog off
+void canvas_set_fog(f32 dist, f32 r, f32 g, f32 b) {
+  frame_block.fog_dist = dist;
+  glm_vec3_copy((vec3) { r, g, b }, frame_block.fog_col);
+  frame_dirty = 1;
 }
 
+// GL work counted over a frame, update_fps moves canvas_stats into canvas_frame and starts over
+typedef struct {
+  u32 uniform_lookups;
+  u32 uniforms_issued, uniforms_skipped;
+  u32 binds_issued, binds_skipped;
+} CanvasStats;
+
+CanvasStats canvas_stats, canvas_frame;
+
 void update_fps(f32* fps, f32* tick) {
   *fps = 1 / (glfwGetTime() - *tick);
   *tick = glfwGetTime();
+  canvas_frame = canvas_stats;
+  memset(&canvas_stats, 0, sizeof(canvas_stats));
+}
+
+
+// State
+
+#define STATE_UNITS   32
+#define STATE_BUFFERS 3
+
+// What was bound last, binding it again is skipped. Programs, VAOs, array, unpack and uniform buffers and textures all go through
+// these here, a raw bind of one of them would leave it stale. Copy buffers aren't tracked and element buffers belong to the VAO
+typedef struct {
+  u32 program, vao;
+  u32 buffers[STATE_BUFFERS];
+  GLenum unit;
+  u32 textures[STATE_UNITS][2];
+} CanvasState;
+
+CanvasState canvas_state = { 0, 0, { 0 }, GL_TEXTURE0 };
+
+u8 state_set(u32* current, u32 value) {
+  if (*current == value) {
+    canvas_stats.binds_skipped++;
+    return 0;
+  }
+  *current = value;
+  canvas_stats.binds_issued++;
+  return 1;
+}
+
+void canvas_use_program(u32 program) {
+  if (state_set(&canvas_state.program, program)) glUseProgram(program);
+}
+
+void canvas_bind_vao(u32 vao) {
+  if (state_set(&canvas_state.vao, vao)) glBindVertexArray(vao);
+}
+
+void canvas_bind_buffer(GLenum target, u32 buffer) {
+  u8 slot = target == GL_ARRAY_BUFFER ? 0 : target == GL_PIXEL_UNPACK_BUFFER ? 1 : 2;
+  ASSERT(slot < 2 || target == GL_UNIFORM_BUFFER, "Buffer target 0x%x isn't tracked", target);
+  if (state_set(&canvas_state.buffers[slot], buffer)) glBindBuffer(target, buffer);
+}
+
+void canvas_active_texture(GLenum unit) {
+  if (state_set(&canvas_state.unit, unit)) glActiveTexture(unit);
+}
+
+// Leaves the unit active, so the texture can be changed right after
+void canvas_bind_texture(GLenum unit, GLenum target, u32 texture) {
+  ASSERT(unit - GL_TEXTURE0 < STATE_UNITS, "Texture unit %u is past STATE_UNITS", unit - GL_TEXTURE0);
+  canvas_active_texture(unit);
+  if (state_set(&canvas_state.textures[unit - GL_TEXTURE0][target == GL_TEXTURE_2D_ARRAY], texture)) glBindTexture(target, texture);
+}
+
+// GL unbinds what it deletes, and the name can come back from the next glGen*
+void canvas_delete_texture(u32 texture) {
+  for (u32 u = 0; u < STATE_UNITS; u++)
+    for (u8 t = 0; t < 2; t++)
+      if (canvas_state.textures[u][t] == texture) canvas_state.textures[u][t] = 0;
+  glDeleteTextures(1, &texture);
+}
+
+void canvas_delete_buffer(u32 buffer) {
+  for (u8 b = 0; b < STATE_BUFFERS; b++)
+    if (canvas_state.buffers[b] == buffer) canvas_state.buffers[b] = 0;
+  glDeleteBuffers(1, &buffer);
 }
 
+// File
+
+typedef struct {
+  c8* data;
+  u32 size;
+  u8  mapped;
+} File;
+
+// Maps a file read-only, data is NULL when it can't be opened. The zero-filled tail of the last page keeps the contents NUL-terminated, files filling whole pages are read into memory instead
+File canvas_map_file(const c8* path) {
+  File file = { NULL, 0, 0 };
+  i32 fd = open(path, O_RDONLY);
+  if (fd < 0) return file;
+
+  struct stat info;
+  fstat(fd, &info);
+  file.size = info.st_size;
+
+  if (file.size % sysconf(_SC_PAGESIZE)) {
+    file.data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    file.mapped = file.data != MAP_FAILED;
+    if (file.mapped) madvise(file.data, file.size, MADV_SEQUENTIAL);
+  }
+
+  if (!file.mapped) {
+    file.data = malloc(file.size + 1);
+    u32 done = 0;
+    for (i64 got = 1; done < file.size && got > 0; done += MAX(got, 0)) got = read(fd, file.data + done, file.size - done);
+    file.data[done] = '\0';
+    file.size = done;
+  }
+
+  close(fd);
+  return file;
+}
+
+void canvas_unmap_file(File file) {
+  if (file.mapped) munmap(file.data, file.size);
+  else             free(file.data);
+}
+
+// Writes the chunks one after another through a temporary file, so path is either left as it was or holds all of them
+u8 canvas_write_file(const c8* path, const File* chunks, u32 count) {
+  c8 temp[520];
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  FILE* file = fopen(temp, "wb");
+  if (!file) return 0;
+
+  for (u32 i = 0; i < count; i++) fwrite(chunks[i].data, 1, chunks[i].size, file);
+  u8 failed = ferror(file);
+  if (fclose(file) || failed || rename(temp, path)) {
+    remove(temp);
+    return 0;
+  }
+  return 1;
+}
+
+// Calls fn with the path and name of every file in dir ending in ext, returns how many there were
+u32 canvas_each_file(const c8* dir, const c8* ext, void (*fn)(const c8* path, const c8* name, void* data), void* data) {
+  DIR* folder = opendir(dir);
+  ASSERT(folder, "Can't open directory (%s)", dir);
+
+  u32 files = 0, length = strlen(ext);
+  struct dirent* entry;
+  while ((entry = readdir(folder))) {
+    u32 len = strlen(entry->d_name);
+    if (len < length || strcmp(entry->d_name + len - length, ext)) continue;
+
+    c8 path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    fn(path, entry->d_name, data);
+    files++;
+  }
+  closedir(folder);
+  return files;
+}
+
+// FNV-1a, continuing from a previous hash hashes the data as if it followed what that one covered
+u32 canvas_hash_continue(u32 hash, const void* data, u32 size) {
+  for (u32 i = 0; i < size; i++) hash = (hash ^ ((const u8*) data)[i]) * 16777619u;
+  return hash;
+}
+
+u32 canvas_hash(const void* data, u32 size) {
+  return canvas_hash_continue(2166136261u, data, size);
+}
+
+// Thread
+
+// Runs fn once per element of args on its own thread, the first one on the calling thread
+void canvas_parallel(void* (*fn)(void*), void* args, u32 stride, u32 amount) {
+  pthread_t threads[amount];
+  for (u32 i = 1; i < amount; i++) pthread_create(&threads[i], NULL, fn, (u8*) args + stride * i);
+  fn(args);
+  for (u32 i = 1; i < amount; i++) pthread_join(threads[i], NULL);
+}
 
 // Object
 
 u32 canvas_create_VBO(u32 size, const void* data, GLenum usage) {
   u32 VBO;
   glGenBuffers(1, &VBO);
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+  canvas_bind_buffer(GL_ARRAY_BUFFER, VBO);
   glBufferData(GL_ARRAY_BUFFER, size, data, usage);
   return VBO;
 }
@@ -123,14 +329,15 @@ u32 canvas_create_VBO(u32 size, const void* data, GLenum usage) {
 u32 canvas_create_VAO() {
   u32 VAO;
   glGenVertexArrays(1, &VAO);
-  glBindVertexArray(VAO);
+  canvas_bind_vao(VAO);
   return VAO;
 }
 
-u32 canvas_create_EBO() {
+u32 canvas_create_EBO(u32 size, const void* data, GLenum usage) {
   u32 EBO;
   glGenBuffers(1, &EBO);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
   return EBO;
 }
 
@@ -141,7 +348,7 @@ u32 canvas_create_FBO(u16 width, u16 height, GLenum min, GLenum mag) {
 
   u32 COLOR;
   glGenTextures(1, &COLOR);
-  glBindTexture(GL_TEXTURE_2D, COLOR);
+  canvas_bind_texture(canvas_state.unit, GL_TEXTURE_2D, COLOR);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, min);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mag);
@@ -161,25 +368,380 @@ void canvas_vertex_attrib_pointer(u8 location, u8 amount, GLenum type, GLenum no
   glEnableVertexAttribArray(location);
 }
 
-// Shader
+// Upload ring
 
-u32 shader_create_program(char vertex_path[], char fragment_path[]) {
-  u32 create_shader(GLenum type, char path[], char name[]) {
-    FILE* file = fopen(path, "r");
-    ASSERT(file, "Can't open %s shader (%s)", name, path);
+#define RING_FENCES 64
+
+// Marks the bytes written before it, from start up to end of the ring's stream, as read once it signals
+typedef struct {
+  GLsync sync;
+  u64 start, end;
+} RingFence;
+
+// One buffer written front to back as a stream that wraps around. Persistently mapped when the driver has buffer storage,
+// fences tell when a region can be written again. Without it the buffer is orphaned on every wrap instead, so nothing waits
+typedef struct {
+  u32 buffer, size;
+  u8* map;
+  u8 persistent;
+  u64 written, fenced;
+  RingFence fences[RING_FENCES];
+  u32 fence_first, fence_count;
+  u32 waits;
+} UploadRing;
+
+UploadRing* ring_create(u32 size) {
+  UploadRing* ring = calloc(1, sizeof(UploadRing));
+  ring->size       = size;
+  ring->persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+  glGenBuffers(1, &ring->buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+  if (ring->persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+    ring->map = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+  }
+  else glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+  return ring;
+}
+
+void ring_wait(UploadRing* ring) {
+  RingFence* fence = &ring->fences[ring->fence_first];
+  if (glClientWaitSync(fence->sync, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    ring->waits++;
+    while (glClientWaitSync(fence->sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1e9) == GL_TIMEOUT_EXPIRED);
+  }
+  glDeleteSync(fence->sync);
+  ring->fence_first = (ring->fence_first + 1) % RING_FENCES;
+  ring->fence_count--;
+}
+
+// Call once the GL commands reading what was written since the last fence are issued, once a frame is enough
+void ring_fence(UploadRing* ring) {
+  if (!ring->persistent || ring->fenced == ring->written) return;
+  if (ring->fence_count == RING_FENCES) ring_wait(ring);
+  RingFence* fence = &ring->fences[(ring->fence_first + ring->fence_count++) % RING_FENCES];
+  fence->sync  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  fence->start = ring->fenced;
+  fence->end   = ring->written;
+  ring->fenced = ring->written;
+}
+
+// Reserves size bytes at an offset that is a multiple of align and returns where to write them, ring_unmap before GL reads them
+u8* ring_map(UploadRing* ring, u32 size, u32 align, u32* offset) {
+  ASSERT(size <= ring->size, "Upload of %u bytes doesn't fit a ring of %u", size, ring->size);
+  u64 start = (ring->written + align - 1) / align * align;
+  if (start % ring->size + size > ring->size) start += ring->size - start % ring->size;
+  *offset = start % ring->size;
+  ring->written = start + size;
+
+  if (!ring->persistent) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+    if (!*offset) glBufferData(GL_COPY_WRITE_BUFFER, ring->size, NULL, GL_STREAM_DRAW);
+    return glMapBufferRange(GL_COPY_WRITE_BUFFER, *offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  }
+
+  // Whatever was written one lap ago at these bytes has to be read already
+  if (ring->fenced + ring->size < ring->written) ring_fence(ring);
+  while (ring->fence_count && ring->fences[ring->fence_first].start + ring->size < ring->written) ring_wait(ring);
+  return ring->map + *offset;
+}
+
+void ring_unmap(UploadRing* ring) {
+  if (ring->persistent) return;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+  glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+}
+
+// Updates part of a buffer through the ring, for dynamic vertex data or uniform blocks
+void ring_copy(UploadRing* ring, u32 buffer, u32 offset, const void* data, u32 size) {
+  u32 from;
+  memcpy(ring_map(ring, size, 4, &from), data, size);
+  ring_unmap(ring);
+  glBindBuffer(GL_COPY_READ_BUFFER,  ring->buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from, offset, size);
+}
+
+void ring_destroy(UploadRing* ring) {
+  while (ring->fence_count) ring_wait(ring);
+  if (ring->persistent) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+  }
+  canvas_delete_buffer(ring->buffer);
+  free(ring);
+}
+
+// Uniform cache
+
+typedef struct {
+  u32 hash;
+  i32 location;
+  c8* name;
+  u32 value;
+} Uniform;
+
+// The last value sent to a location, the bare name of an array shares the one of its first element
+typedef struct {
+  u8 set;
+  u8 data[64];
+} UniformValue;
+
+// Every active uniform of a program sorted by name hash, read once after linking. Arrays get an entry per element and one for their bare name
+typedef struct {
+  u32 program;
+  Uniform* uniforms;
+  u32 size, capacity;
+  UniformValue* values;
+  u32 values_size, values_capacity;
+} UniformCache;
+
+// One per program, shader variants make one for every feature set drawn. Each is its own allocation, so the last one looked up stays put when this grows
+UniformCache** uniform_caches;
+u32 uniform_caches_size, uniform_caches_capacity;
+
+i32 uniform_compare(const void* a, const void* b) {
+  u32 x = ((const Uniform*) a)->hash, y = ((const Uniform*) b)->hash;
+  return (x > y) - (x < y);
+}
+
+UniformCache* uniform_cache(u32 program) {
+  static UniformCache* last;
+  if (last && last->program == program) return last;
+  for (u32 i = 0; i < uniform_caches_size; i++)
+    if (uniform_caches[i]->program == program) return last = uniform_caches[i];
+  return NULL;
+}
+
+// A value of -1 takes a new one
+void uniform_cache_add(UniformCache* cache, const c8* name, i32 location, i32 value) {
+  if (value < 0) {
+    GROW(cache->values, cache->values_capacity, cache->values_size + 1);
+    cache->values[cache->values_size] = (UniformValue) { 0 };
+    value = cache->values_size++;
+  }
+  GROW(cache->uniforms, cache->capacity, cache->size + 1);
+  cache->uniforms[cache->size++] = (Uniform) { canvas_hash(name, strlen(name)), location, strdup(name), value };
+}
+
+void shader_cache_uniforms(u32 program) {
+  UniformCache* cache = uniform_cache(program);
+  if (!cache) {
+    GROW(uniform_caches, uniform_caches_capacity, uniform_caches_size + 1);
+    cache = uniform_caches[uniform_caches_size++] = calloc(1, sizeof(UniformCache));
+    cache->program = program;
+  }
+  for (u32 i = 0; i < cache->size; i++) free(cache->uniforms[i].name);
+  cache->size = cache->values_size = 0;
+
+  i32 count, length, blocks;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &length);
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+  c8 name[length + 16];
+
+  // Block members have no location. Drivers can walk every uniform to find one index, so they're ruled out a block at a time
+  u8 in_block[MAX(count, 1)];
+  memset(in_block, 0, count);
+  for (i32 b = 0; b < blocks; b++) {
+    i32 members;
+    glGetActiveUniformBlockiv(program, b, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &members);
+    i32 indices[MAX(members, 1)];
+    glGetActiveUniformBlockiv(program, b, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, indices);
+    for (i32 m = 0; m < members; m++) in_block[indices[m]] = 1;
+  }
+
+  for (i32 i = 0; i < count; i++) {
+    if (in_block[i]) continue;
+    i32 size;
+    GLenum type;
+    glGetActiveUniform(program, i, length, NULL, &size, &type, name);
+    i32 location = glGetUniformLocation(program, name);
+    canvas_stats.uniform_lookups++;
+    if (location < 0) continue;
+
+    u32 len = strlen(name);
+    if (len < 3 || strcmp(name + len - 3, "[0]")) {
+      uniform_cache_add(cache, name, location, -1);
+      continue;
+    }
+    u32 first = cache->values_size;
+    for (i32 e = 0; e < size; e++) {
+      sprintf(name + len - 3, "[%i]", e);
+      uniform_cache_add(cache, name, location + e, -1);
+    }
+    name[len - 3] = '\0';
+    uniform_cache_add(cache, name, location, first);
+  }
+  qsort(cache->uniforms, cache->size, sizeof(Uniform), uniform_compare);
+}
+
+Uniform* uniform_find(UniformCache* cache, const c8* name) {
+  u32 hash = canvas_hash(name, strlen(name)), low = 0, high = cache->size;
+  while (low < high) {
+    u32 mid = (low + high) / 2;
+    if (cache->uniforms[mid].hash < hash) low = mid + 1;
+    else                                  high = mid;
+  }
+  for (; low < cache->size && cache->uniforms[low].hash == hash; low++)
+    if (!strcmp(cache->uniforms[low].name, name)) return &cache->uniforms[low];
+  return NULL;
+}
+
+// What UNI resolves to, -1 like glGetUniformLocation for names the program doesn't use. Only programs made elsewhere still ask GL.
+// A handle of shader variants stands for the variant selected last
+i32 shader_uniform(u32 program, const c8* name) {
+  program = shader_program(program);
+  UniformCache* cache = uniform_cache(program);
+  if (!cache) {
+    canvas_stats.uniform_lookups++;
+    return glGetUniformLocation(program, name);
+  }
+  Uniform* uniform = uniform_find(cache, name);
+  return uniform ? uniform->location : -1;
+}
+
+// The location to send the value to, -1 when the program already has it or doesn't use the name.
+// Makes the program current, glUniform* writes to the one in use
+i32 uniform_update(u32 program, const c8* name, const void* data, u32 size) {
+  program = shader_program(program);
+  if (canvas_state.program != program) canvas_use_program(program);
+  UniformCache* cache = uniform_cache(program);
+  if (!cache) {
+    canvas_stats.uniforms_issued++;
+    return shader_uniform(program, name);
+  }
+
+  Uniform* uniform = uniform_find(cache, name);
+  UniformValue* value = uniform ? &cache->values[uniform->value] : NULL;
+  if (!value || (value->set && !memcmp(value->data, data, size))) {
+    canvas_stats.uniforms_skipped++;
+    return -1;
+  }
+  value->set = 1;
+  memcpy(value->data, data, size);
+  canvas_stats.uniforms_issued++;
+  return uniform->location;
+}
+
+// Program binaries
+
+#define PROGRAM_MAGIC   0x474F5250
+#define PROGRAM_VERSION 1
+
+// Written next to the vertex shader as <name>-<variant>.prog, followed by the driver's binary. The key covers both sources, the
+// defines and the driver, anything else fails to match and the program is compiled and written again
+typedef struct {
+  u32 magic, version;
+  u32 key, format, size;
+  f32 compile_time;
+} ProgramHeader;
+
+typedef struct {
+  u32 loaded, compiled;
+  f64 load_time, compile_time, saved;
+} ShaderStats;
+
+ShaderStats shader_stats;
+
+u8 shader_binaries() {
+  if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary) return 0;
+  i32 formats;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+// One file per vertex, fragment and defines, so variants of a shader don't overwrite each other
+void shader_cache_path(c8* cache, u32 length, const c8* vertex_path, const c8* fragment_path, const c8* defines) {
+  u32 len = strlen(vertex_path);
+  if (len > 2 && !strcmp(vertex_path + len - 2, ".v")) len -= 2;
+  u32 variant = canvas_hash_continue(canvas_hash(fragment_path, strlen(fragment_path) + 1), defines, strlen(defines));
+  snprintf(cache, length, "%.*s-%08x.prog", len, vertex_path, variant);
+}
+
+u32 shader_cache_key(File vertex, File fragment, const c8* defines) {
+  const c8* driver[] = { (const c8*) glGetString(GL_VENDOR), (const c8*) glGetString(GL_RENDERER), (const c8*) glGetString(GL_VERSION) };
+  u32 key = canvas_hash(vertex.data, vertex.size);
+  key = canvas_hash_continue(key, fragment.data, fragment.size);
+  key = canvas_hash_continue(key, defines, strlen(defines) + 1);
+  for (u8 i = 0; i < 3; i++) key = canvas_hash_continue(key, driver[i], strlen(driver[i]) + 1);
+  return key;
+}
+
+// 0 when there's no usable binary, a driver can refuse one it wrote itself
+u32 shader_load_binary(const c8* cache, u32 key, f32* compile_time) {
+  File file = canvas_map_file(cache);
+  if (!file.data) return 0;
+
+  u32 program = 0;
+  ProgramHeader* header = (ProgramHeader*) file.data;
+  if (file.size >= sizeof(ProgramHeader) && header->magic == PROGRAM_MAGIC && header->version == PROGRAM_VERSION && header->key == key &&
+      file.size == sizeof(ProgramHeader) + header->size) {
+    program = glCreateProgram();
+    glProgramBinary(program, header->format, header + 1, header->size);
     i32 success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (success) *compile_time = header->compile_time;
+    else {
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  canvas_unmap_file(file);
+  return program;
+}
 
-    fseek(file, 0, SEEK_END);
-    int size = ftell(file);
-    rewind(file);
+void shader_save_binary(u32 program, const c8* cache, u32 key, f32 compile_time) {
+  i32 size;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) return;
 
-    char shader_source[size];
-    fread(shader_source, sizeof(char), size - 1, file);
-    shader_source[size - 1] = '\0';
-    fclose(file);
+  ProgramHeader header = { PROGRAM_MAGIC, PROGRAM_VERSION, key, 0, 0, compile_time };
+  u8* binary = malloc(size);
+  glGetProgramBinary(program, size, &size, &header.format, binary);
+  header.size = size;
+
+  File chunks[] = { { (c8*) &header, sizeof(header), 0 }, { (c8*) binary, size, 0 } };
+  canvas_write_file(cache, chunks, 2);
+  free(binary);
+}
+
+void shader_cache_stats() {
+  PRINT("%u programs from binaries in %.2f ms, %.2f ms of compiling saved", shader_stats.loaded, shader_stats.load_time * 1e3, shader_stats.saved * 1e3);
+  PRINT("%u programs compiled in %.2f ms", shader_stats.compiled, shader_stats.compile_time * 1e3);
+}
+
+// Shader
+
+#define FRAME_BINDING     1
+#define LIGHTS_BINDING    2
+#define MATERIALS_BINDING 3
+
+// Points the engine's blocks a program declares at their bindings, the buffers behind them are set up in Uniform blocks
+void shader_bind_blocks(u32 program) {
+  const c8* names[] = { "FRAME", "LIGHTS", "MATERIALS" };
+  for (u8 i = 0; i < 3; i++) {
+    u32 block = glGetUniformBlockIndex(program, names[i]);
+    if (block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, FRAME_BINDING + i);
+  }
+}
+
+// Defines go right after the #version line of both shaders, or replace it when they start with their own.
+// The linked program is kept as a binary when the driver allows it, later runs load that instead of compiling
+u32 shader_create_program_defines(char vertex_path[], char fragment_path[], const c8* defines) {
+  u32 create_shader(GLenum type, char path[], char name[], File file) {
+    ASSERT(file.data, "Can't open %s shader (%s)", name, path);
+    i32 success;
+
+    c8* body = strchr(file.data, '\n');
+    body = body ? body + 1 : file.data + file.size;
+    u8 version = !strncmp(defines, "#version", 8);
+    const c8* sources[3] = { file.data, defines, body };
+    i32 lengths[3] = { version ? 0 : body - file.data, -1, file.data + file.size - body };
 
     u32 shader = glCreateShader(type);
-    glShaderSource(shader, 1, (const char * const *) &(const char *) { shader_source }, NULL);
+    glShaderSource(shader, 3, sources, lengths);
     glCompileShader(shader);
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
@@ -187,23 +749,56 @@ u32 shader_create_program(char vertex_path[], char fragment_path[]) {
     return shader;
   }
 
-  u32 v_shader = create_shader(GL_VERTEX_SHADER, vertex_path, "vertex");
-  u32 f_shader = create_shader(GL_FRAGMENT_SHADER, fragment_path, "fragment");
-  u32 shader_program = glCreateProgram();
-  glAttachShader(shader_program, v_shader);
-  glAttachShader(shader_program, f_shader);
-  glLinkProgram(shader_program);
-  glDeleteShader(v_shader);
-  glDeleteShader(f_shader);
+  File vertex = canvas_map_file(vertex_path), fragment = canvas_map_file(fragment_path);
+  u8 binaries = vertex.data && fragment.data && shader_binaries();
+  c8 cache[512];
+  u32 key = 0;
+  f32 compile_time = 0;
+  if (binaries) {
+    shader_cache_path(cache, sizeof(cache), vertex_path, fragment_path, defines);
+    key = shader_cache_key(vertex, fragment, defines);
+  }
 
-  i32 success;
-  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-  ASSERT(success, "Error linking shaders");
+  f64 start = glfwGetTime();
+  u32 shader_program = binaries ? shader_load_binary(cache, key, &compile_time) : 0;
+  if (shader_program) {
+    f64 time = glfwGetTime() - start;
+    shader_stats.loaded++;
+    shader_stats.load_time += time;
+    shader_stats.saved += compile_time - time;
+  } else {
+    u32 v_shader = create_shader(GL_VERTEX_SHADER, vertex_path, "vertex", vertex);
+    u32 f_shader = create_shader(GL_FRAGMENT_SHADER, fragment_path, "fragment", fragment);
+    shader_program = glCreateProgram();
+    if (binaries) glProgramParameteri(shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(shader_program, v_shader);
+    glAttachShader(shader_program, f_shader);
+    glLinkProgram(shader_program);
+    glDeleteShader(v_shader);
+    glDeleteShader(f_shader);
+
+    i32 success;
+    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    ASSERT(success, "Error linking shaders");
+
+    compile_time = glfwGetTime() - start;
+    shader_stats.compiled++;
+    shader_stats.compile_time += compile_time;
+    if (binaries) shader_save_binary(shader_program, cache, key, compile_time);
+  }
+  canvas_unmap_file(vertex);
+  canvas_unmap_file(fragment);
 
-  glUseProgram(shader_program);
+  shader_cache_uniforms(shader_program);
+  shader_bind_blocks(shader_program);
+  canvas_use_program(shader_program);
   return shader_program;
 }
 
+u32 shader_create_program(char vertex_path[], char fragment_path[]) {
+  return shader_create_program_defines(vertex_path, fragment_path, "");
+}
+
 u32 shader_create_program_raw(const char* v_shader_source, const char* f_shader_source) {
   u32 v_shader = glCreateShader(GL_VERTEX_SHADER);
   u32 f_shader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -219,259 +814,2918 @@ u32 shader_create_program_raw(const char* v_shader_source, const char* f_shader_
   glDeleteShader(v_shader);
   glDeleteShader(f_shader);
 
-  glUseProgram(shader_program);
+  shader_cache_uniforms(shader_program);
+  shader_bind_blocks(shader_program);
+  canvas_use_program(shader_program);
   return shader_program;
 }
 
-void canvas_uni1i(u16 s, char u[], i32 v1)                 { glUniform1i(UNI(s, u), v1); }
-void canvas_uni1f(u16 s, char u[], f32 v1)                 { glUniform1f(UNI(s, u), v1); }
-void canvas_uni2i(u16 s, char u[], i32 v1, i32 v2)         { glUniform2i(UNI(s, u), v1, v2); }
-void canvas_uni2f(u16 s, char u[], f32 v1, f32 v2)         { glUniform2f(UNI(s, u), v1, v2); }
-void canvas_uni3i(u16 s, char u[], i32 v1, i32 v2, i32 v3) { glUniform3i(UNI(s, u), v1, v2, v3); }
-void canvas_uni3f(u16 s, char u[], f32 v1, f32 v2, f32 v3) { glUniform3f(UNI(s, u), v1, v2, v3); }
-void canvas_unim4(u16 s, char u[], const f32* m)           { glUniformMatrix4fv(UNI(s, u), 1, GL_FALSE, m); }
+void canvas_uni1i(u16 s, char u[], i32 v1)                 { i32 v[] = { v1 };         i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform1i(l, v1); }
+void canvas_uni1f(u16 s, char u[], f32 v1)                 { f32 v[] = { v1 };         i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform1f(l, v1); }
+void canvas_uni2i(u16 s, char u[], i32 v1, i32 v2)         { i32 v[] = { v1, v2 };     i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform2i(l, v1, v2); }
+void canvas_uni2f(u16 s, char u[], f32 v1, f32 v2)         { f32 v[] = { v1, v2 };     i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform2f(l, v1, v2); }
+void canvas_uni3i(u16 s, char u[], i32 v1, i32 v2, i32 v3) { i32 v[] = { v1, v2, v3 }; i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform3i(l, v1, v2, v3); }
+void canvas_uni3f(u16 s, char u[], f32 v1, f32 v2, f32 v3) { f32 v[] = { v1, v2, v3 }; i32 l = uniform_update(s, u, v, sizeof(v)); if (l >= 0) glUniform3f(l, v1, v2, v3); }
+void canvas_unim4(u16 s, char u[], const f32* m)           { i32 l = uniform_update(s, u, m, 16 * sizeof(f32));       if (l >= 0) glUniformMatrix4fv(l, 1, GL_FALSE, m); }
 
-// Texture
+// Shader variants
 
-typedef struct {
-  GLenum wrap_s, wrap_t, min_filter, mag_filter;
-} TextureConfig;
+#define VARIANT_SETS     8
+#define VARIANT_PROGRAMS 32
 
-TextureConfig TEXTURE_DEFAULT = { GL_MIRRORED_REPEAT, GL_MIRRORED_REPEAT, GL_NEAREST, GL_NEAREST };
+// Each one compiles in the define of the same name without VARIANT_
+typedef enum {
+  VARIANT_LIT        = 1 << 0,
+  VARIANT_TEXTURED   = 1 << 1,
+  VARIANT_ALPHA_TEST = 1 << 2,
+  VARIANT_TABLE      = 1 << 3,
+} VariantFeature;
 
-u32 canvas_create_texture(GLenum unit, char path[], TextureConfig config) {
-  FILE* img = fopen(path, "r");
-  ASSERT(img, "Can't open image (%s)", path);
+// How many lights of each kind a lit variant loops over, as DIR_LIG_AMOUNT, PNT_LIG_AMOUNT and SPT_LIG_AMOUNT
+#define VARIANT_LIGHTS(dir, pnt, spt) ((u32) (dir) << 8 | (u32) (pnt) << 12 | (u32) (spt) << 16)
 
-  u16 ppm, width, height, max_color;
-  fscanf(img, "P%hi %hi %hi %hi", &ppm, &width, &height, &max_color);
-  ASSERT(ppm == 3, "Not a PPM3 (%s)", path);
-  
-  f32* buffer = malloc(sizeof(f32) * width * height * 3);
-  for (u32 i = 0; i < width * height * 3; i += 3) {
-    fscanf(img, "%f %f %f", &buffer[i], &buffer[i + 1], &buffer[i + 2]);
-    glm_vec3_scale(&buffer[i], (f32) 1 / max_color, &buffer[i]);
-  }
-  fclose(img); 
+// A shader compiled once for every combination of features it gets drawn with, so none of them are branched on per fragment.
+// Uniforms set through the handle go to the variant selected last, attach runs on each variant once it's compiled
+typedef struct {
+  c8    vertex_path[256], fragment_path[256], defines[256];
+  u32   handle, current, current_features;
+  u32   features[VARIANT_PROGRAMS], programs[VARIANT_PROGRAMS];
+  u32   size;
+  void  (*attach)(void* data, u32 program);
+  void* attach_data;
+} ShaderVariants;
+
+ShaderVariants variant_sets[VARIANT_SETS];
+u32 variant_sets_size;
+
+ShaderVariants* shader_variants(u32 shader) {
+  for (u32 i = 0; i < variant_sets_size; i++)
+    if (variant_sets[i].handle == shader) return &variant_sets[i];
+  return NULL;
+}
 
-  u32 texture;
-  glGenTextures(1, &texture);
-  glActiveTexture(unit);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     config.wrap_s);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     config.wrap_t);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, config.min_filter);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, config.mag_filter);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, buffer);
-  glGenerateMipmap(GL_TEXTURE_2D);
+u32 shader_program(u32 shader) {
+  ShaderVariants* variants = shader_variants(shader);
+  return variants ? variants->current : shader;
+}
 
-  free(buffer);
-  return texture;
+// Nothing is compiled until a variant is selected. The handle is a program name that never gets linked, so no real program shares it
+u32 shader_create_variants(char vertex_path[], char fragment_path[], const c8* defines) {
+  ASSERT(variant_sets_size < VARIANT_SETS, "Too many shader variant sets");
+  ASSERT(strlen(vertex_path) < 256 && strlen(fragment_path) < 256 && strlen(defines) < 256, "Shader variant paths or defines too long");
+  ShaderVariants* variants = &variant_sets[variant_sets_size++];
+  *variants = (ShaderVariants) { .handle = glCreateProgram() };
+  strcpy(variants->vertex_path, vertex_path);
+  strcpy(variants->fragment_path, fragment_path);
+  strcpy(variants->defines, defines);
+  return variants->handle;
 }
 
-// Material
+// Makes the variant with these features current, compiling it the first time it's asked for. Each one keeps its own binary
+u32 shader_select(u32 shader, u32 features) {
+  ShaderVariants* variants = shader_variants(shader);
+  if (!variants) return shader;
+  if (variants->current && variants->current_features == features) return variants->current;
+  variants->current_features = features;
+  for (u32 i = 0; i < variants->size; i++)
+    if (variants->features[i] == features) return variants->current = variants->programs[i];
+
+  ASSERT(variants->size < VARIANT_PROGRAMS, "Too many variants of %s", variants->fragment_path);
+  c8 defines[512];
+  snprintf(defines, sizeof(defines), "%s%s%s%s%s#define DIR_LIG_AMOUNT %u\n#define PNT_LIG_AMOUNT %u\n#define SPT_LIG_AMOUNT %u\n", variants->defines,
+           features & VARIANT_LIT ? "#define LIT\n" : "", features & VARIANT_TEXTURED ? "#define TEXTURED\n" : "",
+           features & VARIANT_ALPHA_TEST ? "#define ALPHA_TEST\n" : "", features & VARIANT_TABLE ? "#define TABLE\n" : "",
+           features >> 8 & 15, features >> 12 & 15, features >> 16 & 15);
+  u32 program = shader_create_program_defines(variants->vertex_path, variants->fragment_path, defines);
+  if (variants->attach) variants->attach(variants->attach_data, program);
+  variants->features[variants->size] = features;
+  variants->programs[variants->size++] = program;
+  return variants->current = program;
+}
 
-typedef struct {
-  vec3 col;
-  f64  amb, dif, spc, shi;
-  u8   s_dif, s_spc, s_emt, lig, png, tex;
-} Material;
+// BC1
 
-void canvas_set_material(u32 shader, Material mat) {
-  canvas_uni3f(shader, "MAT.COL", mat.col[0], mat.col[1], mat.col[2]);
-  canvas_uni1f(shader, "MAT.AMB", mat.amb);
-  canvas_uni1f(shader, "MAT.DIF", mat.dif);
-  canvas_uni1f(shader, "MAT.SPC", mat.spc);
-  canvas_uni1f(shader, "MAT.SHI", mat.shi);
-  canvas_uni1i(shader, "MAT.S_DIF", mat.s_dif);
-  canvas_uni1i(shader, "MAT.S_SPC", mat.s_spc);
-  canvas_uni1i(shader, "MAT.S_EMT", mat.s_emt);
-  canvas_uni1i(shader, "MAT.LIG", mat.lig);
-  canvas_uni1i(shader, "MAT.PNG", mat.png);
-  canvas_uni1i(shader, "MAT.TEX", mat.tex);
+u32 bc1_level_size(u32 width, u32 height) {
+  return ((width + 3) / 4) * ((height + 3) / 4) * 8;
 }
 
-// Animation
+u16 bc1_pack(const f32* rgb) {
+  u32 r = CLAMP(0, roundf(rgb[0] * 31 / 255), 31);
+  u32 g = CLAMP(0, roundf(rgb[1] * 63 / 255), 63);
+  u32 b = CLAMP(0, roundf(rgb[2] * 31 / 255), 31);
+  return r << 11 | g << 5 | b;
+}
 
-typedef struct {
-  u8  stage, size;
-  f32 pos;
-} Animation;
+void bc1_unpack(u16 color, i32* rgb) {
+  i32 r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+  rgb[0] = r << 3 | r >> 2;
+  rgb[1] = g << 2 | g >> 4;
+  rgb[2] = b << 3 | b >> 2;
+}
 
-void animation_start(Animation* anim) {
-  anim->stage = 1;
+// The four colors a block picks from. With c0 <= c1 the block is in three color mode and the last one is transparent black
+void bc1_palette(u16 c0, u16 c1, i32 palette[4][4]) {
+  bc1_unpack(c0, palette[0]);
+  bc1_unpack(c1, palette[1]);
+  for (u8 c = 0; c < 3; c++) {
+    palette[2][c] = c0 > c1 ? (2 * palette[0][c] + palette[1][c]) / 3 : (palette[0][c] + palette[1][c]) / 2;
+    palette[3][c] = c0 > c1 ? (palette[0][c] + 2 * palette[1][c]) / 3 : 0;
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = c0 > c1 ? 255 : 0;
 }
 
-u8 animation_run(Animation* anim, f32 rate) {
-  if (!anim->stage) return 0;
-  anim->pos += rate;
-  if (anim->pos < 1) return 0;
+// Picks the closest palette entry for every texel, transparent ones (alpha < 128) take the transparent entry. Returns the squared error
+u32 bc1_indexes(const u8 texels[16][4], u16 c0, u16 c1, u32* bits) {
+  i32 palette[4][4];
+  bc1_palette(c0, c1, palette);
+
+  u32 error = 0;
+  *bits = 0;
+  for (u8 i = 0; i < 16; i++) {
+    u32 best = 3, best_error = 0;
+    if (texels[i][3] >= 128) {
+      best_error = ~0u;
+      for (u8 p = 0; p < (c0 > c1 ? 4 : 3); p++) {
+        u32 e = 0;
+        for (u8 c = 0; c < 3; c++) e += (texels[i][c] - palette[p][c]) * (texels[i][c] - palette[p][c]);
+        if (e < best_error) best_error = e, best = p;
+      }
+    }
+    error += best_error;
+    *bits |= best << (2 * i);
+  }
+  return error;
+}
 
-  anim->pos = 0;
-  anim->stage += 1;
-  if (anim->stage <= anim->size) return 0;
-  anim->stage = 0;
-  return 1;
+// Orders the endpoints for the mode the block needs, three color mode only when it has transparent texels
+u32 bc1_fit(const u8 texels[16][4], u16 c0, u16 c1, u8 transparent, u8* out) {
+  if ((c0 > c1) == transparent) {
+    u16 t = c0;
+    c0 = c1;
+    c1 = t;
+  }
+  u32 bits, error = bc1_indexes(texels, c0, c1, &bits);
+  out[0] = c0;
+  out[1] = c0 >> 8;
+  out[2] = c1;
+  out[3] = c1 >> 8;
+  memcpy(out + 4, &bits, sizeof(u32));
+  return error;
 }
 
-// Model 
+// Endpoints from the extremes along the principal axis of the opaque texels, then refitted once by least squares on the indexes they got
+void bc1_encode_block(const u8 texels[16][4], u8* out) {
+  f32 mean[3] = { 0, 0, 0 }, cov[6] = { 0, 0, 0, 0, 0, 0 };
+  u8 opaque = 0;
+  for (u8 i = 0; i < 16; i++) {
+    if (texels[i][3] < 128) continue;
+    for (u8 c = 0; c < 3; c++) mean[c] += texels[i][c];
+    opaque++;
+  }
+  if (!opaque) {
+    memset(out, 0, 4);
+    memset(out + 4, 0xFF, 4);
+    return;
+  }
+  for (u8 c = 0; c < 3; c++) mean[c] /= opaque;
+  for (u8 i = 0; i < 16; i++) {
+    if (texels[i][3] < 128) continue;
+    f32 d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+    cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+  }
 
-typedef f32 Vertex[8];
+  vec3 axis = { 1, 1, 1 };
+  for (u8 k = 0; k < 8; k++) {
+    vec3 next = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                  cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                  cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+    f32 len = glm_vec3_norm(next);
+    if (len < 1e-6) break;
+    glm_vec3_scale(next, 1 / len, axis);
+  }
+  glm_vec3_normalize(axis);
+
+  f32 lo = 0, hi = 0;
+  for (u8 i = 0; i < 16; i++) {
+    if (texels[i][3] < 128) continue;
+    f32 t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+    lo = MIN(lo, t);
+    hi = MAX(hi, t);
+  }
+  vec3 e0, e1;
+  for (u8 c = 0; c < 3; c++) e0[c] = mean[c] + axis[c] * hi, e1[c] = mean[c] + axis[c] * lo;
+
+  u8 transparent = opaque < 16;
+  u32 error = bc1_fit(texels, bc1_pack(e0), bc1_pack(e1), transparent, out);
+  if (!error) return;
+
+  // Weight of the first endpoint for each index, in both modes
+  const f32 weights[2][4] = { { 1, 0, 2.0 / 3, 1.0 / 3 }, { 1, 0, 0.5, 0 } };
+  u16 c0 = out[0] | out[1] << 8, c1 = out[2] | out[3] << 8;
+  u32 bits;
+  memcpy(&bits, out + 4, sizeof(u32));
+  f32 a = 0, b = 0, c = 0;
+  vec3 x0 = { 0, 0, 0 }, x1 = { 0, 0, 0 };
+  for (u8 i = 0; i < 16; i++) {
+    if (texels[i][3] < 128) continue;
+    f32 w0 = weights[c0 <= c1][bits >> (2 * i) & 3], w1 = 1 - w0;
+    a += w0 * w0;
+    b += w0 * w1;
+    c += w1 * w1;
+    for (u8 k = 0; k < 3; k++) x0[k] += w0 * texels[i][k], x1[k] += w1 * texels[i][k];
+  }
+  f32 det = a * c - b * b;
+  if (fabsf(det) < 1e-6) return;
+  for (u8 k = 0; k < 3; k++) {
+    e0[k] = (c * x0[k] - b * x1[k]) / det;
+    e1[k] = (a * x1[k] - b * x0[k]) / det;
+  }
 
-typedef struct {
-  u32 size, VAO, VBO;
-  Vertex* vertexes;
-  mat4 model;
-  Material** materials;
-} Model;
+  u8 refit[8];
+  if (bc1_fit(texels, bc1_pack(e0), bc1_pack(e1), transparent, refit) < error) memcpy(out, refit, sizeof(refit));
+}
 
-Vertex* model_parse(const c8* path, u32* size, f32 scale) {
-  vec3*   poss = malloc(sizeof(vec3));
-  vec3*   nrms = malloc(sizeof(vec3));
-  vec2*   texs = malloc(sizeof(vec2));
-  Vertex* vrts = malloc(sizeof(Vertex));
-
-  u32 pos_i = 0;
-  u32 nrm_i = 0;
-  u32 tex_i = 0;
-  u32 vrt_i = 0;
-
-  FILE* file = fopen(path, "r");
-  ASSERT(file != NULL, "Can't open .obj file (%s)", path)
-  c8 buffer[256];
-  while (fgets(buffer, 256, file)) {
-    if      (buffer[0] == 'v' && buffer[1] == ' ') {
-      poss = realloc(poss, sizeof(vec3) * (++pos_i + 1));
-      sscanf(buffer, "v  %f %f %f", &poss[pos_i][0], &poss[pos_i][1], &poss[pos_i][2]);
-      glm_vec3_scale(poss[pos_i], scale, poss[pos_i]);
-    } 
-    else if (buffer[0] == 'v' && buffer[1] == 'n') {
-      nrms = realloc(nrms, sizeof(vec3) * (++nrm_i + 1));
-      sscanf(buffer, "vn %f %f %f", &nrms[nrm_i][0], &nrms[nrm_i][1], &nrms[nrm_i][2]);
-    }
-    else if (buffer[0] == 'v' && buffer[1] == 't') {
-      texs = realloc(texs, sizeof(vec2) * (++tex_i + 1));
-      sscanf(buffer, "vt %f %f",    &texs[tex_i][0], &texs[tex_i][1]);
-    }
-    else if (buffer[0] == 'f') {
-      u32 vs[4][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
-
-      sscanf(buffer, "f %d/  /%d %d/  /%d %d/  /%d",          &vs[0][0],            &vs[0][2], &vs[1][0],            &vs[1][2], &vs[2][0],            &vs[2][2]);
-      sscanf(buffer, "f %d/%d/%d %d/%d/%d %d/%d/%d",          &vs[0][0], &vs[0][1], &vs[0][2], &vs[1][0], &vs[1][1], &vs[1][2], &vs[2][0], &vs[2][1], &vs[2][2]);
-      sscanf(buffer, "f %d/  /%d %d/  /%d %d/  /%d %d/  /%d", &vs[0][0],            &vs[0][2], &vs[1][0],            &vs[1][2], &vs[2][0],            &vs[2][2], &vs[3][0],            &vs[3][2]);
-      sscanf(buffer, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", &vs[0][0], &vs[0][1], &vs[0][2], &vs[1][0], &vs[1][1], &vs[1][2], &vs[2][0], &vs[2][1], &vs[2][2], &vs[3][0], &vs[3][1], &vs[3][2]);
-
-      vrts = realloc(vrts, sizeof(Vertex) * (vrt_i + 3));
-      for (u8 i = 0; i < 3; i++) {
-        glm_vec3_copy(poss[vs[i][0]],  vrts[vrt_i]);
-        glm_vec3_copy(nrms[vs[i][2]], &vrts[vrt_i][3]);
-        glm_vec2_copy(texs[vs[i][1]], &vrts[vrt_i][6]);
-        vrt_i++;
-      }
+void bc1_decode_block(const u8* in, u8 texels[16][4]) {
+  u16 c0 = in[0] | in[1] << 8, c1 = in[2] | in[3] << 8;
+  u32 bits;
+  memcpy(&bits, in + 4, sizeof(u32));
+  i32 palette[4][4];
+  bc1_palette(c0, c1, palette);
+  for (u8 i = 0; i < 16; i++)
+    for (u8 c = 0; c < 4; c++) texels[i][c] = palette[bits >> (2 * i) & 3][c];
+}
 
-      if (!vs[3][0]) continue;
-      vrts = realloc(vrts, sizeof(Vertex) * (vrt_i + 3));
+// Mipmaps
 
-      for (u8 i = 1; i < 4; i++) {
-        glm_vec3_copy(poss[vs[i == 1 ? 0 : i][0]],  vrts[vrt_i]);
-        glm_vec3_copy(nrms[vs[i == 1 ? 0 : i][2]], &vrts[vrt_i][3]);
-        glm_vec2_copy(texs[vs[i == 1 ? 0 : i][1]], &vrts[vrt_i][6]);
-        vrt_i++;
-      }
-    }
-  }
+#define MIP_SRGB_LUT   16384
+#define MIP_TAPS_MAX   8
+#define MIP_BENCH_RUNS 20
 
-  fclose(file);
-  free(poss);
-  free(nrms);
-  free(texs);
+// Box averages each 2x2, Kaiser is an 8 tap windowed sinc that keeps more detail
+typedef enum { MIP_BOX, MIP_KAISER } MipFilter;
+typedef enum { MIP_SCALAR, MIP_SSE2, MIP_AVX2 } MipSimd;
 
-  *size = vrt_i;
-  return vrts;
+f32 mip_linear[256];
+u8  mip_srgb[MIP_SRGB_LUT];
+f32 mip_weights[2][MIP_TAPS_MAX];
+const u8 mip_taps[2] = { 2, 8 };
+pthread_once_t mip_once = PTHREAD_ONCE_INIT;
+
+f64 mip_bessel_i0(f64 x) {
+  f64 sum = 1, term = 1;
+  for (u32 k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum  += term;
+  }
+  return sum;
 }
 
-Model* model_create(const c8* path, f32 scale, Material** materials) {
-  Model* model = malloc(sizeof(Model));
-  model->vertexes = model_parse(path, &model->size, scale);
-  model->materials = materials;
+void mip_init(void) {
+  for (u32 i = 0; i < 256; i++) {
+    f64 c = i / 255.0;
+    mip_linear[i] = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+  }
+  for (u32 i = 0; i < MIP_SRGB_LUT; i++) {
+    f64 l = (f64) i / (MIP_SRGB_LUT - 1);
+    mip_srgb[i] = round((l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055) * 255);
+  }
 
-  model->VAO = canvas_create_VAO();
-  model->VBO = canvas_create_VBO(model->size * sizeof(Vertex), model->vertexes, GL_STATIC_DRAW);
-  canvas_vertex_attrib_pointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(f32), (void*) 0);
-  canvas_vertex_attrib_pointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(f32), (void*) (3 * sizeof(f32)));
-  canvas_vertex_attrib_pointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(f32), (void*) (6 * sizeof(f32)));
+  mip_weights[MIP_BOX][0] = mip_weights[MIP_BOX][1] = 0.5;
+  f64 sum = 0;
+  for (u8 k = 0; k < 8; k++) {
+    f64 x = k - 3.5, t = x / 4;
+    mip_weights[MIP_KAISER][k] = sin(M_PI * x / 2) / (M_PI * x / 2) * mip_bessel_i0(4 * sqrt(1 - t * t)) / mip_bessel_i0(4);
+    sum += mip_weights[MIP_KAISER][k];
+  }
+  for (u8 k = 0; k < 8; k++) mip_weights[MIP_KAISER][k] /= sum;
+}
 
-  return model;
+MipSimd mip_simd_best(void) {
+#ifdef CGLM_SSE2_FP
+  return __builtin_cpu_supports("avx2") ? MIP_AVX2 : MIP_SSE2;
+#else
+  return MIP_SCALAR;
+#endif
 }
 
-void model_bind(Model* model, u32 shader, u8 material) {
-  if (material) canvas_set_material(shader, *model->materials[material - 1]);
-  glm_mat4_identity(model->model);
+// sRGB bytes to premultiplied linear RGBA, anything without a fourth channel is opaque and one or two channel ones leave the rest 0
+void mip_decode(const u8* pixels, u32 count, u8 channels, f32* out) {
+  u8 colors = MIN(channels, 3);
+  for (u32 i = 0; i < count; i++, pixels += channels, out += 4) {
+    f32 a = channels == 4 ? pixels[3] / 255.0f : 1;
+    for (u8 c = 0; c < 3; c++) out[c] = c < colors ? mip_linear[pixels[c]] * a : 0;
+    out[3] = a;
+  }
 }
 
-void model_draw(Model* model, u32 shader) {
-  glBindBuffer(GL_ARRAY_BUFFER, model->VBO);
-  glBindVertexArray(model->VAO);
-  canvas_unim4(shader, "MODEL", model->model[0]);
-  glDrawArrays(GL_TRIANGLES, 0, model->size);
+void mip_encode(const f32* texels, u32 count, u8 channels, u8* out) {
+  u8 colors = MIN(channels, 3);
+  for (u32 i = 0; i < count; i++, texels += 4, out += channels) {
+    f32 a = CLAMP(0, texels[3], 1);
+    for (u8 c = 0; c < colors; c++) {
+      f32 v = a > 0 ? texels[c] / a : 0;
+      out[c] = mip_srgb[(u32) (CLAMP(0, v, 1) * (MIP_SRGB_LUT - 1) + 0.5f)];
+    }
+    if (channels == 4) out[3] = a * 255 + 0.5f;
+  }
 }
 
-// Light
+// Horizontal pass, out[i] sums the taps from texel 2i of a row that is already padded at both edges
+void mip_row_scalar(const f32* row, u32 count, const f32* weights, u8 taps, f32* out) {
+  for (u32 i = 0; i < count; i++)
+    for (u8 c = 0; c < 4; c++) {
+      f32 sum = 0;
+      for (u8 k = 0; k < taps; k++) sum += weights[k] * row[(2 * i + k) * 4 + c];
+      out[i * 4 + c] = sum;
+    }
+}
 
-typedef struct {
-  vec3 col, dir;
-} DirLig;
+// Vertical pass over count floats, one source row per tap
+void mip_column_scalar(const f32** rows, u32 count, const f32* weights, u8 taps, f32* out) {
+  for (u32 x = 0; x < count; x++) {
+    f32 sum = 0;
+    for (u8 k = 0; k < taps; k++) sum += weights[k] * rows[k][x];
+    out[x] = sum;
+  }
+}
 
-typedef struct {
-  vec3 col, pos;
-  f32  con, lin, qua;
-} PntLig;
+// The SIMD passes add the taps in the same order as the scalar ones, so all three give the same bits
+#ifdef CGLM_SSE2_FP
+void mip_row_sse2(const f32* row, u32 count, const f32* weights, u8 taps, f32* out) {
+  for (u32 i = 0; i < count; i++) {
+    __m128 sum = _mm_setzero_ps();
+    for (u8 k = 0; k < taps; k++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + (2 * i + k) * 4)));
+    _mm_storeu_ps(out + i * 4, sum);
+  }
+}
+
+void mip_column_sse2(const f32** rows, u32 count, const f32* weights, u8 taps, f32* out) {
+  for (u32 x = 0; x < count; x += 4) {
+    __m128 sum = _mm_setzero_ps();
+    for (u8 k = 0; k < taps; k++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + x)));
+    _mm_storeu_ps(out + x, sum);
+  }
+}
+
+// Two output texels per register, their taps sit two texels apart in the row
+__attribute__((target("avx2"))) void mip_row_avx2(const f32* row, u32 count, const f32* weights, u8 taps, f32* out) {
+  u32 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m256 sum = _mm256_setzero_ps();
+    for (u8 k = 0; k < taps; k++) {
+      const f32* texel = row + (2 * i + k) * 4;
+      __m256 pair = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(texel)), _mm_loadu_ps(texel + 8), 1);
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), pair));
+    }
+    _mm256_storeu_ps(out + i * 4, sum);
+  }
+  if (i < count) mip_row_sse2(row + 2 * i * 4, count - i, weights, taps, out + i * 4);
+}
+
+__attribute__((target("avx2"))) void mip_column_avx2(const f32** rows, u32 count, const f32* weights, u8 taps, f32* out) {
+  u32 x = 0;
+  for (; x + 8 <= count; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (u8 k = 0; k < taps; k++) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + x)));
+    _mm256_storeu_ps(out + x, sum);
+  }
+  if (x < count) {
+    const f32* tail[MIP_TAPS_MAX];
+    for (u8 k = 0; k < taps; k++) tail[k] = rows[k] + x;
+    mip_column_sse2(tail, count - x, weights, taps, out + x);
+  }
+}
+#endif
+
+// Halves a premultiplied linear level, rows into tmp and then columns into dst, clamping at the edges. pad holds one padded row
+void mip_downsample(const f32* src, u32 width, u32 height, f32* tmp, f32* pad, f32* dst, MipFilter filter, MipSimd simd) {
+  void (*row)(const f32*, u32, const f32*, u8, f32*) = mip_row_scalar;
+  void (*column)(const f32**, u32, const f32*, u8, f32*) = mip_column_scalar;
+#ifdef CGLM_SSE2_FP
+  if (simd == MIP_SSE2) row = mip_row_sse2, column = mip_column_sse2;
+  if (simd == MIP_AVX2) row = mip_row_avx2, column = mip_column_avx2;
+#endif
+
+  u32 w = MAX(width / 2, 1), h = MAX(height / 2, 1);
+  u8 taps = mip_taps[filter];
+  i32 lead = taps / 2 - 1;
+  const f32* weights = mip_weights[filter];
+
+  for (u32 y = 0; y < height; y++) {
+    for (i32 p = 0; p < 2 * w + taps - 2; p++) memcpy(pad + p * 4, src + (y * width + CLAMP(0, p - lead, (i32) width - 1)) * 4, 4 * sizeof(f32));
+    row(pad, w, weights, taps, tmp + y * w * 4);
+  }
+
+  const f32* rows[MIP_TAPS_MAX];
+  for (u32 y = 0; y < h; y++) {
+    for (u8 k = 0; k < taps; k++) rows[k] = tmp + CLAMP(0, (i32) (2 * y + k) - lead, (i32) height - 1) * w * 4;
+    column(rows, w * 4, weights, taps, dst + y * w * 4);
+  }
+}
+
+// Whole chain of a one to four channel image filtered in linear light, laid out like a cooked texture: every level as a u32 size and its bytes.
+// The first level is the image itself
+u8* mip_chain(const u8* pixels, u8 channels, u32 width, u32 height, MipFilter filter, MipSimd simd, u8* levels, u64* bytes) {
+  pthread_once(&mip_once, mip_init);
+
+  *levels = 1;
+  *bytes  = sizeof(u32) + width * height * channels;
+  for (u32 w = width, h = height; w > 1 || h > 1; (*levels)++) {
+    w = MAX(w / 2, 1);
+    h = MAX(h / 2, 1);
+    *bytes += sizeof(u32) + w * h * channels;
+  }
+
+  u8* chain = malloc(*bytes);
+  u8* out = chain;
+  u32 size = width * height * channels;
+  memcpy(out, &size, sizeof(u32));
+  memcpy(out + sizeof(u32), pixels, size);
+  out += sizeof(u32) + size;
+
+  u32 half = MAX(width / 2, 1) * MAX(height / 2, 1);
+  f32* src = malloc(width * height * 4 * sizeof(f32));
+  f32* dst = malloc(half * 4 * sizeof(f32));
+  f32* tmp = malloc(MAX(width / 2, 1) * height * 4 * sizeof(f32));
+  f32* pad = malloc((width + MIP_TAPS_MAX) * 4 * sizeof(f32));
+  mip_decode(pixels, width * height, channels, src);
+
+  for (u8 level = 1; level < *levels; level++) {
+    mip_downsample(src, width, height, tmp, pad, dst, filter, simd);
+    width  = MAX(width / 2, 1);
+    height = MAX(height / 2, 1);
+
+    size = width * height * channels;
+    memcpy(out, &size, sizeof(u32));
+    mip_encode(dst, width * height, channels, out + sizeof(u32));
+    out += sizeof(u32) + size;
+
+    f32* t = src;
+    src = dst;
+    dst = t;
+  }
+  free(src);
+  free(dst);
+  free(tmp);
+  free(pad);
+  return chain;
+}
+
+// Texture
+
+// Compressed textures are cooked to BC1 next to the .ppm, keyed ones also turn the texels of the key color transparent.
+// Mipmaps are built on the CPU with the filter. Streamed ones loaded through a Loader become usable with their smallest mips
+// and get the finer ones over the next frames
+typedef struct {
+  GLenum wrap_s, wrap_t, min_filter, mag_filter;
+  u8 compressed, keyed;
+  u8 key[3];
+  MipFilter filter;
+  u8 streamed;
+} TextureConfig;
+
+TextureConfig TEXTURE_DEFAULT    = { GL_MIRRORED_REPEAT, GL_MIRRORED_REPEAT, GL_NEAREST, GL_NEAREST, 0, 0, { 0, 0, 0 }, MIP_BOX, 0 };
+TextureConfig TEXTURE_COMPRESSED = { GL_MIRRORED_REPEAT, GL_MIRRORED_REPEAT, GL_NEAREST, GL_NEAREST, 1, 0, { 0, 0, 0 }, MIP_BOX, 0 };
+
+#define IMAGE_BENCH_RUNS 10
+
+// Pixels of channels bytes when levels is 0, otherwise a whole mip chain with every level as a u32 size and its bytes, BC1 when format is set.
+// The file is what backs a chain. Swizzle maps the stored channels back to RGBA, unset for BC1
+typedef struct {
+  u16 width, height;
+  u8* pixels;
+  GLenum format;
+  u8 levels;
+  File file;
+  u8 channels;
+  GLint swizzle[4];
+} Image;
+
+// Reads a header number, skipping whitespace and # comments before it
+u32 ppm_scan_header(const c8** str, const c8* end) {
+  const c8* s = *str;
+  while (s < end && !IS_DIGIT(*s)) {
+    if (*s == '#') while (s < end && *s != '\n') s++;
+    else s++;
+  }
+  u32 val = 0;
+  for (; IS_DIGIT(*s); s++) val = val * 10 + (*s - '0');
+  *str = s;
+  return val;
+}
+
+// Decodes an ASCII P3 or binary P6 into RGB bytes without touching GL, so it can run on any thread
+Image canvas_load_image(const c8* path) {
+  File file = canvas_map_file(path);
+  ASSERT(file.data, "Can't open image (%s)", path);
+  const c8* s   = file.data;
+  const c8* end = file.data + file.size;
+  ASSERT(file.size > 2 && s[0] == 'P' && (s[1] == '3' || s[1] == '6'), "Not a PPM3 or PPM6 (%s)", path);
+
+  u8 binary = s[1] == '6';
+  s += 2;
+  u32 width     = ppm_scan_header(&s, end);
+  u32 height    = ppm_scan_header(&s, end);
+  u32 max_color = ppm_scan_header(&s, end);
+  ASSERT(width && height && max_color && max_color < 1 << 16, "Bad PPM header (%s)", path);
+
+  u32 amount = width * height * 3;
+  u8* pixels = malloc(amount);
+  if (binary) {
+    u8 wide = max_color > 255;
+    const u8* data = (const u8*) s + 1;
+    ASSERT(data + amount * (wide + 1) <= (const u8*) end, "Truncated PPM (%s)", path);
+    if (max_color == 255) memcpy(pixels, data, amount);
+    else for (u32 i = 0; i < amount; i++) {
+      u32 val = wide ? data[i * 2] << 8 | data[i * 2 + 1] : data[i];
+      pixels[i] = (val * 255 + max_color / 2) / max_color;
+    }
+  }
+  else for (u32 i = 0; i < amount; i++) {
+    while (!IS_DIGIT(*s)) {
+      ASSERT(s < end, "Truncated PPM (%s)", path);
+      s++;
+    }
+    u32 val = *s++ - '0';
+    while (IS_DIGIT(*s)) val = val * 10 + (*s++ - '0');
+    pixels[i] = max_color == 255 ? val : (val * 255 + max_color / 2) / max_color;
+  }
+
+  canvas_unmap_file(file);
+  return (Image) { width, height, pixels, 0, 0, { 0 }, 3, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE } };
+}
+
+// Texture formats
+
+// Stores only the channels the images need. Channels that are 0 or 255 everywhere become GL_ZERO or GL_ONE in the swizzle,
+// ones equal to an earlier channel read that one, so grayscale ends up GL_R8. A lone image of one color shrinks to a single texel.
+// Layers are decided together so they keep sharing a format
+void canvas_pack_images(Image* images, u16 layers) {
+  u8 zero[3] = { 1, 1, 1 }, one[3] = { 1, 1, 1 }, same[3][3];
+  memset(same, 1, sizeof(same));
+  for (u16 l = 0; l < layers; l++) {
+    const u8* pixels = images[l].pixels;
+    u32 count = images[l].width * images[l].height;
+    if (layers == 1 && count > 1) {
+      u32 i = 1;
+      while (i < count && !memcmp(pixels + i * 3, pixels, 3)) i++;
+      if (i == count) images[l].width = images[l].height = count = 1;
+    }
+    for (u32 i = 0; i < count; i++)
+      for (u8 c = 0; c < 3; c++) {
+        zero[c] &= pixels[i * 3 + c] == 0;
+        one[c]  &= pixels[i * 3 + c] == 255;
+        for (u8 d = 0; d < c; d++) same[c][d] &= pixels[i * 3 + c] == pixels[i * 3 + d];
+      }
+  }
+
+  GLint swizzle[4] = { GL_ZERO, GL_ZERO, GL_ZERO, GL_ONE };
+  u8 source[3] = { 0 }, channels = 0;
+  for (u8 c = 0; c < 3; c++) {
+    if      (zero[c]) swizzle[c] = GL_ZERO;
+    else if (one[c])  swizzle[c] = GL_ONE;
+    else {
+      u8 d = 0;
+      while (d < c && (!same[c][d] || zero[d] || one[d])) d++;
+      if (d < c) swizzle[c] = swizzle[d];
+      else {
+        swizzle[c] = GL_RED + channels;
+        source[channels++] = c;
+      }
+    }
+  }
+  channels = MAX(channels, 1);
+
+  for (u16 l = 0; l < layers; l++) {
+    u8* pixels = images[l].pixels;
+    u32 count = images[l].width * images[l].height;
+    for (u32 i = 0; i < count; i++)
+      for (u8 k = 0; k < channels; k++) pixels[i * channels + k] = pixels[i * 3 + source[k]];
+    images[l].channels = channels;
+    memcpy(images[l].swizzle, swizzle, sizeof(swizzle));
+  }
+}
+
+// Pixel format of an uncompressed image and the internal one it's stored as
+GLenum canvas_image_format(Image image, GLint* internal) {
+  if (image.channels == 1) {
+    *internal = GL_R8;
+    return GL_RED;
+  }
+  if (image.channels == 2) {
+    *internal = GL_RG8;
+    return GL_RG;
+  }
+  *internal = GL_RGB8;
+  return GL_RGB;
+}
+
+void canvas_texture_swizzle(GLenum target, Image image) {
+  if (image.swizzle[0]) glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, image.swizzle);
+}
+
+// Texture cache
+
+#define TEXTURE_MAGIC   0x31584554
+#define TEXTURE_VERSION 2
+
+// Written next to the .ppm as <name>-<variant>.tex, followed by every mip level as a u32 size and its blocks, like KTX does
+typedef struct {
+  u32 magic, version;
+  i64 mtime;
+  u64 source_size;
+  u32 format, width, height, levels;
+  u32 keyed, filter;
+  u8  key[4];
+} TextureHeader;
+
+// One file per key and filter, like the registry keeps a texture per config, so loading a .ppm two ways doesn't rewrite one over the other
+void canvas_texture_cache_path(c8* cache, u32 length, const c8* path, TextureConfig config) {
+  u32 len = strlen(path);
+  if (len > 4 && !strcmp(path + len - 4, ".ppm")) len -= 4;
+  u8 key[] = { config.keyed, config.keyed ? config.key[0] : 0, config.keyed ? config.key[1] : 0, config.keyed ? config.key[2] : 0, config.filter };
+  snprintf(cache, length, "%.*s-%08x.tex", len, path, canvas_hash(key, sizeof(key)));
+}
+
+u8 canvas_texture_cache_valid(TextureHeader* header, struct stat* info, TextureConfig config) {
+  return header->magic == TEXTURE_MAGIC && header->version == TEXTURE_VERSION && header->mtime == info->st_mtime && header->source_size == info->st_size &&
+         header->keyed == config.keyed && (!config.keyed || !memcmp(header->key, config.key, 3)) && header->filter == config.filter;
+}
+
+// Builds the mip chain of the .ppm and encodes it to BC1 without touching GL, laid out in memory exactly like the .tex
+Image canvas_cook_texture(const c8* path, TextureConfig config) {
+  struct stat info;
+  memset(&info, 0, sizeof(info));
+  stat(path, &info);
+  Image source = canvas_load_image(path);
+  u32 w = source.width, h = source.height;
+
+  u8 levels = 1;
+  u64 bytes = sizeof(TextureHeader) + sizeof(u32) + bc1_level_size(w, h);
+  for (u32 lw = w, lh = h; lw > 1 || lh > 1; levels++) {
+    lw = MAX(lw / 2, 1);
+    lh = MAX(lh / 2, 1);
+    bytes += sizeof(u32) + bc1_level_size(lw, lh);
+  }
+
+  c8* blob = calloc(1, bytes);
+  TextureHeader* header = (TextureHeader*) blob;
+  header->magic       = TEXTURE_MAGIC;
+  header->version     = TEXTURE_VERSION;
+  header->mtime       = info.st_mtime;
+  header->source_size = info.st_size;
+  header->format      = config.keyed ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  header->width       = w;
+  header->height      = h;
+  header->levels      = levels;
+  header->keyed       = config.keyed;
+  header->filter      = config.filter;
+  memcpy(header->key, config.key, 3);
+
+  u8* rgba = malloc(w * h * 4);
+  for (u32 i = 0; i < w * h; i++) {
+    memcpy(rgba + i * 4, source.pixels + i * 3, 3);
+    rgba[i * 4 + 3] = config.keyed && !memcmp(source.pixels + i * 3, config.key, 3) ? 0 : 255;
+  }
+  free(source.pixels);
+
+  u64 chain_bytes;
+  u8* chain = mip_chain(rgba, 4, w, h, config.filter, mip_simd_best(), &levels, &chain_bytes);
+  free(rgba);
+
+  u8* out = (u8*) (header + 1);
+  u8* level = chain;
+  for (u8 i = 0; i < levels; i++) {
+    u32 size = bc1_level_size(w, h);
+    memcpy(out, &size, sizeof(u32));
+    out += sizeof(u32);
+    level += sizeof(u32);
+    for (u32 by = 0; by < h; by += 4)
+      for (u32 bx = 0; bx < w; bx += 4, out += 8) {
+        u8 texels[16][4];
+        for (u8 t = 0; t < 16; t++) memcpy(texels[t], level + (MIN(by + t / 4, h - 1) * w + MIN(bx + t % 4, w - 1)) * 4, 4);
+        bc1_encode_block(texels, out);
+      }
+    level += w * h * 4;
+    w = MAX(w / 2, 1);
+    h = MAX(h / 2, 1);
+  }
+  free(chain);
+
+  return (Image) { header->width, header->height, (u8*) (header + 1), header->format, levels, (File) { blob, bytes, 0 } };
+}
+
+// Maps a .tex straight into the image, fails when it's missing or was cooked from another .ppm or key
+u8 canvas_load_texture_cache(Image* image, const c8* path, TextureConfig config) {
+  struct stat info;
+  if (stat(path, &info)) return 0;
+
+  c8 cache[512];
+  canvas_texture_cache_path(cache, sizeof(cache), path, config);
+  File file = canvas_map_file(cache);
+  if (!file.data) return 0;
+
+  TextureHeader* header = (TextureHeader*) file.data;
+  u64 bytes = sizeof(TextureHeader);
+  if (file.size >= sizeof(TextureHeader))
+    for (u32 i = 0; i < header->levels && i < 32; i++) bytes += sizeof(u32) + bc1_level_size(MAX(header->width >> i, 1), MAX(header->height >> i, 1));
+  if (file.size < sizeof(TextureHeader) || !canvas_texture_cache_valid(header, &info, config) || bytes != file.size) {
+    canvas_unmap_file(file);
+    return 0;
+  }
+
+  *image = (Image) { header->width, header->height, (u8*) (header + 1), header->format, header->levels, file };
+  return 1;
+}
+
+void canvas_save_texture_cache(const c8* path, Image image, TextureConfig config) {
+  c8 cache[512];
+  canvas_texture_cache_path(cache, sizeof(cache), path, config);
+  canvas_write_file(cache, &image.file, 1);
+}
+
+// Packed R8, RG8 or RGB8 mip chains for uncompressed configs or drivers without S3TC, otherwise the cooked ones,
+// cooking them first when the .tex is stale. paths[i] becomes images[i], packed together
+void canvas_load_textures(const c8* paths[], Image* images, u16 layers, TextureConfig config) {
+  if (!config.compressed || !GLAD_GL_EXT_texture_compression_s3tc) {
+    for (u16 l = 0; l < layers; l++) images[l] = canvas_load_image(paths[l]);
+    canvas_pack_images(images, layers);
+    for (u16 l = 0; l < layers; l++) {
+      Image* image = &images[l];
+      u64 bytes;
+      u8* chain = mip_chain(image->pixels, image->channels, image->width, image->height, config.filter, mip_simd_best(), &image->levels, &bytes);
+      free(image->pixels);
+      image->pixels = chain;
+      image->file   = (File) { (c8*) chain, bytes, 0 };
+    }
+    return;
+  }
+
+  for (u16 l = 0; l < layers; l++) {
+    if (canvas_load_texture_cache(&images[l], paths[l], config)) continue;
+    images[l] = canvas_cook_texture(paths[l], config);
+    canvas_save_texture_cache(paths[l], images[l], config);
+  }
+}
+
+Image canvas_load_texture(const c8* path, TextureConfig config) {
+  Image image;
+  canvas_load_textures(&path, &image, 1, config);
+  return image;
+}
+
+void canvas_free_image(Image image) {
+  if (image.file.data) canvas_unmap_file(image.file);
+  else                 free(image.pixels);
+}
+
+// PSNR in dB of the top level of a cooked image against its .ppm, keyed texels count as exact when they came out transparent
+f32 canvas_texture_psnr(const c8* path, Image image, TextureConfig config) {
+  Image source = canvas_load_image(path);
+  const u8* blocks = image.pixels + sizeof(u32);
+  f64 error = 0;
+  for (u32 by = 0; by < image.height; by += 4)
+    for (u32 bx = 0; bx < image.width; bx += 4, blocks += 8) {
+      u8 texels[16][4];
+      bc1_decode_block(blocks, texels);
+      for (u8 i = 0; i < 16; i++) {
+        u32 x = bx + i % 4, y = by + i / 4;
+        if (x >= image.width || y >= image.height) continue;
+        const u8* src = source.pixels + (y * image.width + x) * 3;
+        u8 keyed = config.keyed && !memcmp(src, config.key, 3);
+        if (keyed || !texels[i][3]) error += keyed == !texels[i][3] ? 0 : 3 * 255 * 255;
+        else for (u8 c = 0; c < 3; c++) error += (src[c] - texels[i][c]) * (src[c] - texels[i][c]);
+      }
+    }
+  free(source.pixels);
+
+  f64 mse = error / (image.width * image.height * 3.0);
+  return mse ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+void canvas_texture_parameters(GLenum target, TextureConfig config) {
+  glTexParameteri(target, GL_TEXTURE_WRAP_S,     config.wrap_s);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T,     config.wrap_t);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, config.min_filter);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, config.mag_filter);
+}
+
+void canvas_upload_texture(GLenum unit, u32 texture, Image image, TextureConfig config) {
+  canvas_bind_texture(unit, GL_TEXTURE_2D, texture);
+  canvas_texture_parameters(GL_TEXTURE_2D, config);
+
+  canvas_texture_swizzle(GL_TEXTURE_2D, image);
+
+  GLint internal;
+  GLenum format = canvas_image_format(image, &internal);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (image.levels) {
+    u8* level = image.pixels;
+    for (u8 i = 0; i < image.levels; i++) {
+      u32 size, w = MAX(image.width >> i, 1), h = MAX(image.height >> i, 1);
+      memcpy(&size, level, sizeof(u32));
+      if (image.format) glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format, w, h, 0, size, level + sizeof(u32));
+      else              glTexImage2D(GL_TEXTURE_2D, i, internal, w, h, 0, format, GL_UNSIGNED_BYTE, level + sizeof(u32));
+      level += sizeof(u32) + size;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+    return;
+  }
+
+  glTexImage2D(GL_TEXTURE_2D, 0, internal, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+  glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+u32 canvas_create_texture(GLenum unit, char path[], TextureConfig config) {
+  Image image = canvas_load_texture(path, config);
+  u32 texture;
+  glGenTextures(1, &texture);
+  canvas_upload_texture(unit, texture, image, config);
+  canvas_free_image(image);
+  return texture;
+}
+
+// Texture array
+
+// One image per layer, they all need the size and format of the first one, as canvas_load_textures packs them
+void canvas_upload_texture_array(GLenum unit, u32 texture, Image* images, u16 layers, TextureConfig config) {
+  Image first = images[0];
+  for (u16 l = 1; l < layers; l++)
+    ASSERT(images[l].width == first.width && images[l].height == first.height && images[l].format == first.format && images[l].levels == first.levels && images[l].channels == first.channels,
+           "Texture array layer %u is %ux%u, the first one is %ux%u", l, images[l].width, images[l].height, first.width, first.height);
+
+  canvas_bind_texture(unit, GL_TEXTURE_2D_ARRAY, texture);
+  canvas_texture_parameters(GL_TEXTURE_2D_ARRAY, config);
+  canvas_texture_swizzle(GL_TEXTURE_2D_ARRAY, first);
+
+  GLint internal;
+  GLenum format = canvas_image_format(first, &internal);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (first.levels) {
+    u32 offset = 0;
+    for (u8 i = 0; i < first.levels; i++) {
+      u32 size, w = MAX(first.width >> i, 1), h = MAX(first.height >> i, 1);
+      memcpy(&size, first.pixels + offset, sizeof(u32));
+      if (first.format) glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, first.format, w, h, layers, 0, size * layers, NULL);
+      else              glTexImage3D(GL_TEXTURE_2D_ARRAY, i, internal, w, h, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+      for (u16 l = 0; l < layers; l++) {
+        u8* pixels = images[l].pixels + offset + sizeof(u32);
+        if (first.format) glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, l, w, h, 1, first.format, size, pixels);
+        else              glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, l, w, h, 1, format, GL_UNSIGNED_BYTE, pixels);
+      }
+      offset += sizeof(u32) + size;
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.levels - 1);
+    return;
+  }
+
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal, first.width, first.height, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+  for (u16 l = 0; l < layers; l++) glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, first.width, first.height, 1, format, GL_UNSIGNED_BYTE, images[l].pixels);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+}
+
+// Packs same-size textures into one object so they share a bind, paths[i] becomes layer i
+u32 canvas_create_texture_array(GLenum unit, const c8* paths[], u16 layers, TextureConfig config) {
+  Image* images = malloc(layers * sizeof(Image));
+  canvas_load_textures(paths, images, layers, config);
+  u32 texture;
+  glGenTextures(1, &texture);
+  canvas_upload_texture_array(unit, texture, images, layers, config);
+  for (u16 l = 0; l < layers; l++) canvas_free_image(images[l]);
+  free(images);
+  return texture;
+}
+
+// Texture batch
+
+#define TEXTURE_BATCH_THREADS 8
+
+// One texture of a batch, canvas_create_textures fills in the texture
+typedef struct {
+  GLenum unit;
+  const c8* path;
+  TextureConfig config;
+  u32 texture;
+  Image image;
+} BatchTexture;
+
+// A decoding thread takes every step-th texture from first on
+typedef struct {
+  BatchTexture* textures;
+  u32 amount, first, step;
+} BatchChunk;
+
+void* canvas_decode_chunk(void* arg) {
+  BatchChunk* chunk = arg;
+  for (u32 i = chunk->first; i < chunk->amount; i += chunk->step) chunk->textures[i].image = canvas_load_texture(chunk->textures[i].path, chunk->textures[i].config);
+  return NULL;
+}
+
+void canvas_decode_textures(BatchTexture* textures, u32 amount, u8 threads) {
+  if (!amount) return;
+  threads = CLAMP(1, threads, amount);
+  BatchChunk chunks[threads];
+  for (u8 t = 0; t < threads; t++) chunks[t] = (BatchChunk) { textures, amount, t, threads };
+  canvas_parallel(canvas_decode_chunk, chunks, sizeof(BatchChunk), threads);
+}
+
+// Decodes the whole batch at once, 0 threads takes one per core, then uploads it in order on the GL thread.
+// A path can only be in a batch once per config, cooking it twice at the same time would race on the .tex of that config
+void canvas_create_textures(BatchTexture* textures, u32 amount, u8 threads) {
+  canvas_decode_textures(textures, amount, threads ? threads : CLAMP(1, sysconf(_SC_NPROCESSORS_ONLN), TEXTURE_BATCH_THREADS));
+  for (u32 i = 0; i < amount; i++) {
+    glGenTextures(1, &textures[i].texture);
+    canvas_upload_texture(textures[i].unit, textures[i].texture, textures[i].image, textures[i].config);
+    canvas_free_image(textures[i].image);
+  }
+}
+
+typedef struct {
+  BatchTexture* textures;
+  u32 size, capacity;
+} BenchBatch;
+
+void canvas_bench_batch_add(const c8* path, const c8* name, void* data) {
+  BenchBatch* batch = data;
+  GROW(batch->textures, batch->capacity, batch->size + 1);
+  batch->textures[batch->size++] = (BatchTexture) { GL_TEXTURE0, strdup(path), TEXTURE_DEFAULT };
+}
+
+// Decodes every .ppm in dir one after another and then on every core, uncompressed so it includes the mip chains
+void canvas_bench_batch(const c8* dir) {
+  BenchBatch batch = { NULL, 0, 0 };
+  canvas_each_file(dir, ".ppm", canvas_bench_batch_add, &batch);
+  BatchTexture* textures = batch.textures;
+  u32 size = batch.size;
+
+  u8 threads = CLAMP(1, sysconf(_SC_NPROCESSORS_ONLN), TEXTURE_BATCH_THREADS);
+  f64 times[2];
+  for (u8 parallel = 0; parallel < 2; parallel++) {
+    f64 start = glfwGetTime();
+    for (u8 i = 0; i < IMAGE_BENCH_RUNS; i++) {
+      canvas_decode_textures(textures, size, parallel ? threads : 1);
+      for (u32 t = 0; t < size; t++) canvas_free_image(textures[t].image);
+    }
+    times[parallel] = (glfwGetTime() - start) / IMAGE_BENCH_RUNS;
+  }
+  PRINT("%u textures serial %.2f ms, parallel %.2f ms on %u threads (%.2fx)", size, times[0] * 1e3, times[1] * 1e3, threads, times[0] / times[1]);
+
+  for (u32 t = 0; t < size; t++) free((c8*) textures[t].path);
+  free(textures);
+}
+
+typedef struct {
+  f64 size, time, pixels;
+} BenchImages;
+
+void canvas_bench_image(const c8* path, const c8* name, void* data) {
+  BenchImages* total = data;
+  struct stat info;
+  stat(path, &info);
+
+  Image image;
+  f64 start = glfwGetTime();
+  for (u8 i = 0; i < IMAGE_BENCH_RUNS; i++) {
+    image = canvas_load_image(path);
+    free(image.pixels);
+  }
+  f64 time = (glfwGetTime() - start) / IMAGE_BENCH_RUNS;
+
+  total->size   += info.st_size;
+  total->time   += time;
+  total->pixels += image.width * image.height;
+  PRINT("%-16s %8.1f KB %5ux%-5u %8.1f MB/s %8.1f Mpx/s", name, info.st_size / 1e3, image.width, image.height, info.st_size / time / 1e6, image.width * image.height / time / 1e6);
+}
+
+// Decodes every .ppm in dir a few times and prints the throughput
+void canvas_bench_images(const c8* dir) {
+  BenchImages total = { 0, 0, 0 };
+  canvas_each_file(dir, ".ppm", canvas_bench_image, &total);
+  PRINT("%-16s %8.1f KB %11s %8.1f MB/s %8.1f Mpx/s", "total", total.size / 1e3, "", total.size / total.time / 1e6, total.pixels / total.time / 1e6);
+}
+
+typedef struct {
+  f64 raw, cooked;
+} BenchTextures;
+
+void canvas_bench_texture(const c8* path, const c8* name, void* data) {
+  BenchTextures* total = data;
+  f64 start = glfwGetTime();
+  Image image = canvas_cook_texture(path, TEXTURE_COMPRESSED);
+  f64 time = glfwGetTime() - start;
+
+  f64 raw = 0, cooked = image.file.size - sizeof(TextureHeader) - image.levels * sizeof(u32);
+  for (u8 i = 0; i < image.levels; i++) raw += MAX(image.width >> i, 1) * MAX(image.height >> i, 1) * 3;
+  total->raw    += raw;
+  total->cooked += cooked;
+  PRINT("%-16s %5ux%-5u %2u levels %8.1f KB -> %6.1f KB %6.1f dB in %6.2f ms", name, image.width, image.height, image.levels, raw / 1e3, cooked / 1e3, canvas_texture_psnr(path, image, TEXTURE_COMPRESSED), time * 1e3);
+  canvas_free_image(image);
+}
+
+// Cooks every .ppm in dir in memory and prints the size against RGB8 with mips, the PSNR of the top level and the cook time
+void canvas_bench_textures(const c8* dir) {
+  BenchTextures total = { 0, 0 };
+  canvas_each_file(dir, ".ppm", canvas_bench_texture, &total);
+  PRINT("%-16s %20s %8.1f KB -> %6.1f KB", "total", "", total.raw / 1e3, total.cooked / 1e3);
+}
+
+void canvas_bench_mip(const c8* path, const c8* name, void* data) {
+  const c8* filters[] = { "box", "kaiser" };
+  const c8* kernels[] = { "scalar", "sse2", "avx2" };
+  MipSimd best = mip_simd_best();
+  Image image = canvas_load_image(path);
+
+  for (MipFilter filter = MIP_BOX; filter <= MIP_KAISER; filter++) {
+    c8 line[256];
+    u32 length = snprintf(line, sizeof(line), "%-16s %4ux%-4u %-6s", name, image.width, image.height, filters[filter]);
+    u8 levels;
+    u64 bytes;
+
+    for (MipSimd simd = MIP_SCALAR; simd <= best; simd++) {
+      f64 start = glfwGetTime();
+      for (u8 i = 0; i < MIP_BENCH_RUNS; i++) free(mip_chain(image.pixels, 3, image.width, image.height, filter, simd, &levels, &bytes));
+      f64 time = (glfwGetTime() - start) / MIP_BENCH_RUNS;
+      length += snprintf(line + length, sizeof(line) - length, " %s %6.3f ms", kernels[simd], time * 1e3);
+    }
+    PRINT("%s", line);
+  }
+
+  u32 texture;
+  glGenTextures(1, &texture);
+  canvas_bind_texture(canvas_state.unit, GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glFinish();
+  f64 start = glfwGetTime();
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glFinish();
+  PRINT("%-16s %9s %-6s %6.3f ms", name, "", "gl", (glfwGetTime() - start) * 1e3);
+  canvas_delete_texture(texture);
+  free(image.pixels);
+}
+
+// Times the mip chain of every .ppm in dir with each filter and kernel next to what glGenerateMipmap takes for the same image,
+// warmed up once. test/runner.c checks the SIMD kernels against the scalar one
+void canvas_bench_mips(const c8* dir) {
+  canvas_each_file(dir, ".ppm", canvas_bench_mip, NULL);
+}
+
+// Uniform blocks
+
+#define LIGHT_AMOUNT    8
+#define MATERIAL_AMOUNT 256
+
+// std140 mirrors of the LIGHTS structs, floats fill the gap after each vec3
+typedef struct {
+  vec3 col;
+  f32  pad0;
+  vec3 dir;
+  f32  pad1;
+} DirLigBlock;
+
+typedef struct {
+  vec3 col;
+  f32  con;
+  vec3 pos;
+  f32  lin, qua, pad[3];
+} PntLigBlock;
+
+typedef struct {
+  vec3 col;
+  f32  con;
+  vec3 pos;
+  f32  lin;
+  vec3 dir;
+  f32  qua, inn, out, pad[2];
+} SptLigBlock;
+
+// Shaders loop up to the count of each kind, the highest light set so far
+typedef struct {
+  i32 dir_count, pnt_count, spt_count, pad;
+  DirLigBlock dir[LIGHT_AMOUNT];
+  PntLigBlock pnt[LIGHT_AMOUNT];
+  SptLigBlock spt[LIGHT_AMOUNT];
+} LightBlock;
+
+// An element of MATERIALS, everything of a material but its sampler units
+typedef struct {
+  vec3 col;
+  f32  shi, amb, dif, spc;
+  i32  lig, png, tex, ent, pad;
+} MaterialBlock;
+
+// FRAME twice for world and screen space, LIGHTS and MATERIALS in one buffer, each at an offset the binding accepts.
+// Changes go to data first and the next draw uploads the span they cover with one glBufferSubData
+typedef struct {
+  u32 ubo, size;
+  u32 frame[2], lights, materials;
+  u8* data;
+  u32 dirty_lo, dirty_hi;
+  u8  screen;
+  u32 material_size, material_next, material_last;
+} UniformBlocks;
+
+UniformBlocks uniform_blocks;
+
+u32 blocks_align(u32 offset, i32 align) {
+  return (offset + align - 1) / align * align;
+}
+
+UniformBlocks* blocks_get() {
+  UniformBlocks* b = &uniform_blocks;
+  if (b->ubo) return b;
+  i32 align;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+  b->frame[1]  = blocks_align(sizeof(FrameBlock), align);
+  b->lights    = blocks_align(b->frame[1] + sizeof(FrameBlock), align);
+  b->materials = blocks_align(b->lights + sizeof(LightBlock), align);
+  b->size      = b->materials + MATERIAL_AMOUNT * sizeof(MaterialBlock);
+  b->data = calloc(1, b->size);
+
+  glGenBuffers(1, &b->ubo);
+  canvas_bind_buffer(GL_UNIFORM_BUFFER, b->ubo);
+  glBufferData(GL_UNIFORM_BUFFER, b->size, b->data, GL_DYNAMIC_DRAW);
+  glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING,     b->ubo, b->frame[0], sizeof(FrameBlock));
+  glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING,    b->ubo, b->lights,    sizeof(LightBlock));
+  glBindBufferRange(GL_UNIFORM_BUFFER, MATERIALS_BINDING, b->ubo, b->materials, MATERIAL_AMOUNT * sizeof(MaterialBlock));
+  return b;
+}
+
+void blocks_dirty(UniformBlocks* b, u32 offset, u32 size) {
+  if (b->dirty_lo == b->dirty_hi) b->dirty_lo = offset;
+  b->dirty_lo = MIN(b->dirty_lo, offset);
+  b->dirty_hi = MAX(b->dirty_hi, offset + size);
+}
+
+// The light setters write here, the whole block goes up with the next draw
+LightBlock* blocks_lights() {
+  UniformBlocks* b = blocks_get();
+  blocks_dirty(b, b->lights, sizeof(LightBlock));
+  return (LightBlock*) (b->data + b->lights);
+}
+
+// The MATERIALS element holding these values. New ones take the next element, once all are taken the oldest goes first
+u32 blocks_material(MaterialBlock* material) {
+  UniformBlocks* b = blocks_get();
+  MaterialBlock* materials = (MaterialBlock*) (b->data + b->materials);
+  if (b->material_size && !memcmp(&materials[b->material_last], material, sizeof(MaterialBlock))) return b->material_last;
+  for (u32 i = 0; i < b->material_size; i++)
+    if (!memcmp(&materials[i], material, sizeof(MaterialBlock))) return b->material_last = i;
+
+  u32 i = b->material_next;
+  b->material_next = (i + 1) % MATERIAL_AMOUNT;
+  b->material_size = MAX(b->material_size, i + 1);
+  materials[i] = *material;
+  blocks_dirty(b, b->materials + i * sizeof(MaterialBlock), sizeof(MaterialBlock));
+  return b->material_last = i;
+}
+
+// Runs before every draw, uploads what changed since the last one and picks the FRAME copy
+void blocks_flush() {
+  UniformBlocks* b = blocks_get();
+  if (frame_dirty) {
+    FrameBlock screen = frame_block;
+    glm_mat4_identity(screen.view);
+    glm_mat4_identity(screen.proj);
+    memcpy(b->data + b->frame[0], &frame_block, sizeof(FrameBlock));
+    memcpy(b->data + b->frame[1], &screen, sizeof(FrameBlock));
+    blocks_dirty(b, b->frame[0], b->frame[1] + sizeof(FrameBlock));
+    frame_dirty = 0;
+  }
+  if (b->dirty_lo != b->dirty_hi) {
+    canvas_bind_buffer(GL_UNIFORM_BUFFER, b->ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, b->dirty_lo, b->dirty_hi - b->dirty_lo, b->data + b->dirty_lo);
+    b->dirty_lo = b->dirty_hi = 0;
+  }
+  if (b->screen != frame_screen) {
+    b->screen = frame_screen;
+    canvas_bind_buffer(GL_UNIFORM_BUFFER, b->ubo);
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, b->ubo, b->frame[b->screen], sizeof(FrameBlock));
+  }
+}
+
+void blocks_destroy() {
+  if (!uniform_blocks.ubo) return;
+  canvas_delete_buffer(uniform_blocks.ubo);
+  free(uniform_blocks.data);
+  uniform_blocks = (UniformBlocks) { 0 };
+  frame_dirty = 1;
+}
+
+// Material
+
+// An entry above 0 samples the maps of entry - 1 in the material table instead of s_dif, s_spc and s_emt
+typedef struct {
+  vec3 col;
+  f64  amb, dif, spc, shi;
+  u8   s_dif, s_spc, s_emt, lig, png, tex;
+  u8   entry;
+} Material;
+
+// Draws only switch MAT.IDX, the sampler units and the variant of shader, lit ones loop over as many lights as are set
+void canvas_set_material(u32 shader, Material mat) {
+  MaterialBlock block = { { mat.col[0], mat.col[1], mat.col[2] }, mat.shi, mat.amb, mat.dif, mat.spc, mat.lig, mat.png, mat.tex, mat.entry };
+  UniformBlocks* b = blocks_get();
+  LightBlock* lights = (LightBlock*) (b->data + b->lights);
+  u32 features = mat.lig ? (mat.tex ? VARIANT_TEXTURED : 0) : VARIANT_LIT | VARIANT_LIGHTS(lights->dir_count, lights->pnt_count, lights->spt_count);
+  shader_select(shader, features | (mat.png ? VARIANT_ALPHA_TEST : 0) | (mat.entry ? VARIANT_TABLE : 0));
+  canvas_uni1i(shader, "MAT.IDX", blocks_material(&block));
+  canvas_uni1i(shader, "MAT.S_DIF", mat.s_dif);
+  canvas_uni1i(shader, "MAT.S_SPC", mat.s_spc);
+  canvas_uni1i(shader, "MAT.S_EMT", mat.s_emt);
+}
+
+// Animation
+
+typedef struct {
+  u8  stage, size;
+  f32 pos;
+} Animation;
+
+void animation_start(Animation* anim) {
+  anim->stage = 1;
+}
+
+u8 animation_run(Animation* anim, f32 rate) {
+  if (!anim->stage) return 0;
+  anim->pos += rate;
+  if (anim->pos < 1) return 0;
+
+  anim->pos = 0;
+  anim->stage += 1;
+  if (anim->stage <= anim->size) return 0;
+  anim->stage = 0;
+  return 1;
+}
+
+// Model 
+
+#define MODEL_PARSE_CHUNK   (1 << 16)
+#define MODEL_PARSE_THREADS 8
+#define MODEL_VERTEX_CACHE  16
+
+typedef f32 Vertex[8];
+
+typedef struct {
+  u8 location, amount, normalize;
+  GLenum type;
+  u32 offset;
+} VertexAttrib;
+
+typedef struct {
+  u32 stride, amount;
+  VertexAttrib attribs[4];
+} VertexLayout;
+
+VertexLayout VERTEX_FLOAT = { sizeof(Vertex), 3, { { 0, 3, GL_FALSE, GL_FLOAT, 0 }, { 1, 3, GL_FALSE, GL_FLOAT, 3 * sizeof(f32) }, { 2, 2, GL_FALSE, GL_FLOAT, 6 * sizeof(f32) } } };
+
+// Position as i16 inside the model bounds, octahedral normal in 10 bit pairs and u16 uv inside the uv bounds, obj.v turns them back
+typedef struct {
+  i16 pos[4];
+  u32 nrm;
+  u16 tex[2];
+} PackedVertex;
+
+VertexLayout VERTEX_PACKED = { sizeof(PackedVertex), 3, { { 0, 3, GL_FALSE, GL_SHORT, 0 }, { 1, 4, GL_FALSE, GL_INT_2_10_10_10_REV, 4 * sizeof(i16) }, { 2, 2, GL_FALSE, GL_UNSIGNED_SHORT, 4 * sizeof(i16) + sizeof(u32) } } };
+
+typedef struct {
+  vec3 pos_cen, pos_ext;
+  vec2 tex_min, tex_ext;
+} VertexPacking;
+
+// A range of the indexes, or of the vertexes when there are none, started by an o, g or usemtl record. Names are canvas_hash of the record text
+typedef struct {
+  u32 first, count, name, material;
+  vec3 min, max;
+} Submesh;
+
+typedef struct {
+  u32 size, count, VAO, VBO, EBO;
+  GLenum index_type;
+  u8 packed;
+  VertexLayout layout;
+  VertexPacking packing;
+  Vertex* vertexes; // PackedVertex ones when packed
+  void* indexes;
+  Submesh* submeshes;
+  u32 submesh_size;
+  File cache;
+  mat4 model;
+  Material** materials;
+} Model;
+
+typedef struct {
+  u8 threads, indexed, optimized, cache, packed;
+} ModelConfig;
+
+ModelConfig MODEL_DEFAULT = { 0, 1, 1, 1, 0 };
+ModelConfig MODEL_PACKED  = { 0, 1, 1, 1, 1 };
+
+#define MODEL_INDEX_SIZE(model) ((model)->index_type == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32))
+
+const f64 POW10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Reads a float the same way strtof does, taking strtof only for values whose rounding is ambiguous
+f32 obj_scan_f32(const c8** str) {
+  const c8* s = *str;
+  while (*s == ' ' || *s == '\t') s++;
+  const c8* start = s;
+  u8 neg = *s == '-';
+  if (*s == '-' || *s == '+') s++;
+
+  u64 man = 0;
+  i32 exp = 0;
+  u8  digits = 0, read = 0;
+  for (; IS_DIGIT(*s); s++, read++) {
+    if (digits < 19) { man = man * 10 + (*s - '0'); digits += man != 0; }
+    else exp++;
+  }
+  if (*s == '.') for (s++; IS_DIGIT(*s); s++, read++) {
+    if (digits < 19) { man = man * 10 + (*s - '0'); digits += man != 0; exp--; }
+  }
+  if (read && (*s | 32) == 'e' && (IS_DIGIT(s[1]) || ((s[1] == '-' || s[1] == '+') && IS_DIGIT(s[2])))) {
+    s++;
+    u8 neg_exp = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    i32 e = 0;
+    for (; IS_DIGIT(*s); s++) e = MIN(e * 10 + (*s - '0'), 1000);
+    exp += neg_exp ? -e : e;
+  }
+
+  if (!read) goto slow;
+  if (!man) { *str = s; return neg ? -0.0f : 0.0f; }
+  if (exp < -22 || exp > 22) goto slow;
+
+  f64 val = exp < 0 ? (f64) man / POW10[-exp] : (f64) man * POW10[exp];
+  if (val < 1.2e-38 || val > 3.4e38) goto slow;
+
+  // The double is within ~1 ulp of the real value, so only a double sitting next to a float midpoint can round wrong
+  u64 bits;
+  memcpy(&bits, &val, sizeof(bits));
+  i32 mid = (i32) (bits & ((1 << 29) - 1)) - (1 << 28);
+  if (mid > -8 && mid < 8) goto slow;
+
+  *str = s;
+  return neg ? -(f32) val : (f32) val;
+
+  slow: {
+    c8* end;
+    f32 val = strtof(start, &end);
+    *str = end;
+    return val;
+  }
+}
+
+i32 obj_scan_i32(const c8** str) {
+  const c8* s = *str;
+  while (*s == ' ' || *s == '\t') s++;
+  u8 neg = *s == '-';
+  if (*s == '-' || *s == '+') s++;
+
+  i32 val = 0;
+  for (; IS_DIGIT(*s); s++) val = val * 10 + (*s - '0');
+  *str = s;
+  return neg ? -val : val;
+}
+
+const c8* obj_next_line(const c8* line, const c8* end) {
+  const c8* eol = memchr(line, '\n', end - line);
+  return eol ? eol + 1 : end;
+}
+
+// A newline-aligned slice of an .obj. Records are kept local to the chunk until the counts of every chunk are known
+typedef struct {
+  u32 first, hash;
+  u8 material;
+} ObjGroup;
+
+typedef struct ObjChunk {
+  const c8 *start, *end;
+  f32 scale;
+  vec3* poss;
+  vec3* nrms;
+  vec2* texs;
+  u32 (*crns)[3];
+  u32* faces;
+  ObjGroup* groups;
+  u32 pos_i, nrm_i, tex_i, crn_i, face_i, group_i;
+  u32 pos_c, nrm_c, tex_c, crn_c, face_c, group_c;
+  u32 pos_b, nrm_b, tex_b;
+  u32 vrt_i, sides;
+  struct ObjChunk* file;
+  Vertex* vrts;
+} ObjChunk;
+
+// Negative indices count back from the records read so far, which only the chunk knows, so they stay chunk-relative until the stitch
+#define OBJ_RELATIVE (1u << 31)
+
+u32 obj_scan_index(const c8** str, u32 read) {
+  i32 index = obj_scan_i32(str);
+  return index < 0 ? OBJ_RELATIVE | ((read + 1 + index) & (OBJ_RELATIVE - 1)) : (u32) index;
+}
+
+void* obj_parse_chunk(void* arg) {
+  ObjChunk* c = arg;
+
+  for (const c8* line = c->start; line < c->end; line = obj_next_line(line, c->end)) {
+    const c8* s = line + 2;
+
+    if      (line[0] == 'v' && line[1] == ' ') {
+      GROW(c->poss, c->pos_c, c->pos_i + 1);
+      for (u8 i = 0; i < 3; i++) c->poss[c->pos_i][i] = obj_scan_f32(&s) * c->scale;
+      c->pos_i++;
+    }
+    else if (line[0] == 'v' && line[1] == 'n') {
+      GROW(c->nrms, c->nrm_c, c->nrm_i + 1);
+      for (u8 i = 0; i < 3; i++) c->nrms[c->nrm_i][i] = obj_scan_f32(&s);
+      c->nrm_i++;
+    }
+    else if (line[0] == 'v' && line[1] == 't') {
+      GROW(c->texs, c->tex_c, c->tex_i + 1);
+      for (u8 i = 0; i < 2; i++) c->texs[c->tex_i][i] = obj_scan_f32(&s);
+      c->tex_i++;
+    }
+    else if (line[0] == 'f') {
+      u32 sides = 0;
+
+      for (s = line + 1;; sides++) {
+        while (*s == ' ' || *s == '\t') s++;
+        if (!IS_DIGIT(*s) && *s != '-') break;
+        GROW(c->crns, c->crn_c, c->crn_i + sides + 1);
+        u32* v = c->crns[c->crn_i + sides];
+        v[0] = obj_scan_index(&s, c->pos_i);
+        v[1] = v[2] = 0;
+        if (*s != '/') continue;
+        if (*++s != '/') v[1] = obj_scan_index(&s, c->tex_i);
+        if (*s == '/') s++, v[2] = obj_scan_index(&s, c->nrm_i);
+      }
+      if (sides < 3) continue;
+
+      GROW(c->faces, c->face_c, c->face_i + 1);
+      c->faces[c->face_i++] = sides;
+      c->crn_i += sides;
+      c->vrt_i += (sides - 2) * 3;
+      c->sides  = MAX(c->sides, sides);
+    }
+    else if (line[0] == 'o' || line[0] == 'g' || !strncmp(line, "usemtl", 6)) {
+      u8 material = line[0] == 'u';
+      for (s = line + (material ? 6 : 1); *s == ' ' || *s == '\t'; s++);
+      const c8* name = s;
+      while (*s && *s != '\n' && *s != '\r') s++;
+      while (s > name && (s[-1] == ' ' || s[-1] == '\t')) s--;
+
+      GROW(c->groups, c->group_c, c->group_i + 1);
+      c->groups[c->group_i++] = (ObjGroup) { c->vrt_i, canvas_hash(name, s - name), material };
+    }
+  }
+  return NULL;
+}
+
+u32 obj_resolve_index(u32 index, u32 base) {
+  return index & OBJ_RELATIVE ? base + ((i32) (index << 1) >> 1) : index;
+}
+
+f32 obj_cross(vec2 a, vec2 b, vec2 c) {
+  return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+// Writes the triangles of a polygon as corner numbers, a fan when it's convex and ear clipping when it isn't
+void obj_triangulate(vec3* poss, u32 (*crns)[3], u32 sides, u32* tris, u32* ring, vec2* flat) {
+  vec3 normal = { 0, 0, 0 };
+  for (u32 i = 0; i < sides; i++) {
+    f32* a = poss[crns[i][0]];
+    f32* b = poss[crns[(i + 1) % sides][0]];
+    normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+    normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+    normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+  }
+  u8 axis = fabsf(normal[0]) > fabsf(normal[1]) ? (fabsf(normal[0]) > fabsf(normal[2]) ? 0 : 2) : (fabsf(normal[1]) > fabsf(normal[2]) ? 1 : 2);
+  f32 sign = normal[axis] < 0 ? -1 : 1;
+  for (u32 i = 0; i < sides; i++) {
+    flat[i][0] = poss[crns[i][0]][(axis + 1) % 3];
+    flat[i][1] = poss[crns[i][0]][(axis + 2) % 3] * sign;
+    ring[i] = i;
+  }
+
+  u8 convex = 1;
+  for (u32 i = 0; i < sides && convex; i++) convex = obj_cross(flat[i], flat[(i + 1) % sides], flat[(i + 2) % sides]) >= 0;
+
+  u32 left = sides, tri_i = 0;
+  while (left > 3 && !convex) {
+    u32 ear = 0;
+    for (; ear < left; ear++) {
+      u32 a = ring[(ear + left - 1) % left], b = ring[ear], c = ring[(ear + 1) % left];
+      if (obj_cross(flat[a], flat[b], flat[c]) <= 0) continue;
+      u8 empty = 1;
+      for (u32 k = 0; k < left && empty; k++) {
+        u32 p = ring[k];
+        if (p == a || p == b || p == c) continue;
+        empty = obj_cross(flat[a], flat[b], flat[p]) < 0 || obj_cross(flat[b], flat[c], flat[p]) < 0 || obj_cross(flat[c], flat[a], flat[p]) < 0;
+      }
+      if (empty) break;
+    }
+    // Self-intersecting or degenerate polygons have no ear left, the rest goes out as a fan
+    if (ear == left) break;
+    tris[tri_i++] = ring[(ear + left - 1) % left];
+    tris[tri_i++] = ring[ear];
+    tris[tri_i++] = ring[(ear + 1) % left];
+    memmove(ring + ear, ring + ear + 1, sizeof(u32) * (left - ear - 1));
+    left--;
+  }
+
+  for (u32 t = 0; t + 2 < left; t++) {
+    tris[tri_i++] = ring[0];
+    tris[tri_i++] = ring[t + 1];
+    tris[tri_i++] = ring[t + 2];
+  }
+}
+
+void* obj_expand_chunk(void* arg) {
+  ObjChunk* c = arg;
+  ObjChunk* f = c->file;
+  u32* tris = malloc(sizeof(u32) * 3 * MAX(c->sides, 3));
+  u32* ring = malloc(sizeof(u32) * MAX(c->sides, 3));
+  vec2* flat = malloc(sizeof(vec2) * MAX(c->sides, 3));
+
+  u32 (*crns)[3] = c->crns;
+  Vertex* vrts = c->vrts;
+  for (u32 i = 0; i < c->face_i; i++) {
+    u32 sides = c->faces[i];
+    for (u32 k = 0; k < sides; k++) {
+      u32* v = crns[k];
+      v[0] = obj_resolve_index(v[0], c->pos_b);
+      v[1] = obj_resolve_index(v[1], c->tex_b);
+      v[2] = obj_resolve_index(v[2], c->nrm_b);
+      ASSERT(v[0] && v[0] <= f->pos_i && v[1] <= f->tex_i && v[2] <= f->nrm_i, "Face index out of range (%u/%u/%u)", v[0], v[1], v[2]);
+    }
+    obj_triangulate(f->poss, crns, sides, tris, ring, flat);
+
+    for (u32 k = 0; k < (sides - 2) * 3; k++, vrts++) {
+      u32* v = crns[tris[k]];
+      glm_vec3_copy(f->poss[v[0]],  *vrts);
+      glm_vec3_copy(f->nrms[v[2]], &(*vrts)[3]);
+      glm_vec2_copy(f->texs[v[1]], &(*vrts)[6]);
+    }
+    crns += sides;
+  }
+
+  free(tris);
+  free(ring);
+  free(flat);
+  return NULL;
+}
+
+// Turns the records of every chunk into submeshes, a record only closes the range before it when that range has vertexes
+u32 obj_submeshes(ObjChunk* chunks, u8 threads, Vertex* vrts, u32 size, Submesh** submeshes) {
+  u32 amount = 1;
+  for (u8 i = 0; i < threads; i++) amount += chunks[i].group_i;
+  Submesh* subs = calloc(amount, sizeof(Submesh));
+
+  u32 sub_i = 0, first = 0, name = 0, material = 0;
+  for (u8 i = 0; i < threads; i++) {
+    for (u32 g = 0; g < chunks[i].group_i; g++) {
+      ObjGroup* group = &chunks[i].groups[g];
+      u32 start = chunks[i].vrts - vrts + group->first;
+      if (start > first) {
+        subs[sub_i++] = (Submesh) { first, start - first, name, material };
+        first = start;
+      }
+      if (group->material) material = group->hash;
+      else                 name     = group->hash;
+    }
+  }
+  if (size > first) subs[sub_i++] = (Submesh) { first, size - first, name, material };
+
+  for (u32 i = 0; i < sub_i; i++) {
+    Submesh* sub = &subs[i];
+    glm_vec3_copy(vrts[sub->first], sub->min);
+    glm_vec3_copy(vrts[sub->first], sub->max);
+    for (u32 v = sub->first + 1; v < sub->first + sub->count; v++) {
+      glm_vec3_minv(sub->min, vrts[v], sub->min);
+      glm_vec3_maxv(sub->max, vrts[v], sub->max);
+    }
+  }
+
+  *submeshes = subs;
+  return sub_i;
+}
+
+// Splits the file in one chunk per thread, 0 threads picks an amount from the file size and the cores available
+// Submeshes can be NULL when the ranges aren't needed
+Vertex* model_parse(const c8* path, u32* size, Submesh** submeshes, u32* submesh_size, f32 scale, u8 threads) {
+  File file = canvas_map_file(path);
+  ASSERT(file.data != NULL, "Can't open .obj file (%s)", path)
+  const c8* end = file.data + file.size;
+
+  if (!threads) threads = CLAMP(1, file.size / MODEL_PARSE_CHUNK, MIN(sysconf(_SC_NPROCESSORS_ONLN), MODEL_PARSE_THREADS));
+  ObjChunk chunks[threads];
+  memset(chunks, 0, sizeof(chunks));
+
+  for (u8 i = 0; i < threads; i++) {
+    chunks[i].start = i ? chunks[i - 1].end : file.data;
+    chunks[i].end   = i == threads - 1 ? end : obj_next_line(file.data + (u64) file.size * (i + 1) / threads, end);
+    chunks[i].scale = scale;
+  }
+  canvas_parallel(obj_parse_chunk, chunks, sizeof(ObjChunk), threads);
+
+  // Index 0 is left blank for the attributes a face skips, so .obj indices can be used as they are
+  ObjChunk whole = { 0 };
+  for (u8 i = 0; i < threads; i++) {
+    whole.pos_i += chunks[i].pos_i;
+    whole.nrm_i += chunks[i].nrm_i;
+    whole.tex_i += chunks[i].tex_i;
+    whole.vrt_i += chunks[i].vrt_i;
+  }
+  whole.poss = calloc(whole.pos_i + 1, sizeof(vec3));
+  whole.nrms = calloc(whole.nrm_i + 1, sizeof(vec3));
+  whole.texs = calloc(whole.tex_i + 1, sizeof(vec2));
+  Vertex* vrts = malloc(sizeof(Vertex) * MAX(whole.vrt_i, 1));
+
+  u32 pos_i = 1, nrm_i = 1, tex_i = 1, vrt_i = 0;
+  for (u8 i = 0; i < threads; i++) {
+    ObjChunk* c = &chunks[i];
+    memcpy(whole.poss + pos_i, c->poss, sizeof(vec3) * c->pos_i);
+    memcpy(whole.nrms + nrm_i, c->nrms, sizeof(vec3) * c->nrm_i);
+    memcpy(whole.texs + tex_i, c->texs, sizeof(vec2) * c->tex_i);
+    c->pos_b = pos_i - 1;
+    c->nrm_b = nrm_i - 1;
+    c->tex_b = tex_i - 1;
+    pos_i += c->pos_i;
+    nrm_i += c->nrm_i;
+    tex_i += c->tex_i;
+    c->file = &whole;
+    c->vrts = vrts + vrt_i;
+    vrt_i += c->vrt_i;
+  }
+  canvas_parallel(obj_expand_chunk, chunks, sizeof(ObjChunk), threads);
+  if (submeshes) *submesh_size = obj_submeshes(chunks, threads, vrts, whole.vrt_i, submeshes);
+
+  for (u8 i = 0; i < threads; i++) {
+    free(chunks[i].poss);
+    free(chunks[i].nrms);
+    free(chunks[i].texs);
+    free(chunks[i].crns);
+    free(chunks[i].faces);
+    free(chunks[i].groups);
+  }
+  free(whole.poss);
+  free(whole.nrms);
+  free(whole.texs);
+  canvas_unmap_file(file);
+
+  *size = whole.vrt_i;
+  return vrts;
+}
+
+// Merges bitwise identical vertexes in place, indexes gets where each of the old vertexes ended up
+u32 model_weld(Vertex* vrts, u32 size, u32* indexes) {
+  u32 cap = 64;
+  while (cap < size * 2) cap *= 2;
+  u32* slots = calloc(cap, sizeof(u32));
+
+  u32 unique = 0;
+  for (u32 i = 0; i < size; i++) {
+    u32 slot = canvas_hash(vrts[i], sizeof(Vertex)) & (cap - 1);
+    while (slots[slot] && memcmp(vrts[slots[slot] - 1], vrts[i], sizeof(Vertex))) slot = (slot + 1) & (cap - 1);
+    if (!slots[slot]) {
+      memcpy(vrts[unique], vrts[i], sizeof(Vertex));
+      slots[slot] = ++unique;
+    }
+    indexes[i] = slots[slot] - 1;
+  }
+
+  free(slots);
+  return unique;
+}
+
+// Tipsify (Sander et al. 2007), fans triangles around recently used vertexes so they stay in a post-transform cache of the given size
+void model_optimize_order(u32* indexes, u32 count, u32 size, u32 cache) {
+  u32 tris = count / 3;
+  u32* starts   = calloc(size + 1, sizeof(u32));
+  u32* adjacent = malloc(sizeof(u32) * MAX(count, 1));
+  u32* live     = calloc(MAX(size, 1), sizeof(u32));
+  u32* stamps   = calloc(MAX(size, 1), sizeof(u32));
+  u32* dead     = malloc(sizeof(u32) * MAX(count, 1));
+  u32* near     = malloc(sizeof(u32) * MAX(count, 1));
+  u32* output   = malloc(sizeof(u32) * MAX(count, 1));
+  u8*  emitted  = calloc(MAX(tris, 1), sizeof(u8));
+
+  for (u32 i = 0; i < tris * 3; i++) live[indexes[i]]++;
+  for (u32 v = 0; v < size; v++) starts[v + 1] = starts[v] + live[v];
+  for (u32 i = 0; i < tris * 3; i++) adjacent[starts[indexes[i]]++] = i / 3;
+  for (u32 v = size; v > 0; v--) starts[v] = starts[v - 1];
+  starts[0] = 0;
+
+  u32 dead_i = 0, out_i = 0, time = cache + 1, cursor = 0;
+  i64 fan = size ? 0 : -1;
+  while (fan >= 0) {
+    u32 near_i = 0;
+    for (u32 a = starts[fan]; a < starts[fan + 1]; a++) {
+      u32 tri = adjacent[a];
+      if (emitted[tri]) continue;
+      emitted[tri] = 1;
+      for (u8 c = 0; c < 3; c++) {
+        u32 v = indexes[tri * 3 + c];
+        output[out_i++] = v;
+        dead[dead_i++] = v;
+        near[near_i++] = v;
+        live[v]--;
+        if (time - stamps[v] > cache) stamps[v] = time++;
+      }
+    }
+
+    // Next fan is the candidate that stays cached longest while its remaining triangles are drawn
+    fan = -1;
+    i64 best = -1;
+    for (u32 i = 0; i < near_i; i++) {
+      u32 v = near[i];
+      if (!live[v]) continue;
+      i64 priority = time - stamps[v] + 2 * live[v] <= cache ? time - stamps[v] : 0;
+      if (priority > best) { best = priority; fan = v; }
+    }
+    while (fan < 0 && dead_i) {
+      u32 v = dead[--dead_i];
+      if (live[v]) fan = v;
+    }
+    for (; fan < 0 && cursor < size; cursor++) if (live[cursor]) fan = cursor;
+  }
+
+  memcpy(indexes, output, sizeof(u32) * out_i);
+  free(starts);
+  free(adjacent);
+  free(live);
+  free(stamps);
+  free(dead);
+  free(near);
+  free(output);
+  free(emitted);
+}
+
+// Renumbers the vertexes in the order the indexes first reach them, so fetches walk the vertex buffer forward
+void model_optimize_fetch(Vertex* vrts, u32* indexes, u32 count, u32 size) {
+  u32* remap = malloc(sizeof(u32) * MAX(size, 1));
+  memset(remap, 0xFF, sizeof(u32) * size);
+  Vertex* sorted = malloc(sizeof(Vertex) * MAX(size, 1));
+
+  u32 next = 0;
+  for (u32 i = 0; i < count; i++) {
+    u32 v = indexes[i];
+    if (remap[v] == (u32) -1) {
+      remap[v] = next++;
+      memcpy(sorted[remap[v]], vrts[v], sizeof(Vertex));
+    }
+    indexes[i] = remap[v];
+  }
+  for (u32 v = 0; v < size; v++) if (remap[v] == (u32) -1) memcpy(sorted[next++], vrts[v], sizeof(Vertex));
+  memcpy(vrts, sorted, sizeof(Vertex) * size);
+
+  free(remap);
+  free(sorted);
+}
+
+// Average cache miss ratio per triangle and per vertex of a FIFO post-transform cache, the best case being 0.5 and 1
+void model_cache_stats(const u32* indexes, u32 count, u32 size, u32 cache, f32* acmr, f32* atvr) {
+  u32* stamps   = calloc(MAX(size, 1), sizeof(u32));
+  u32 misses = 0;
+  for (u32 i = 0; i < count; i++) {
+    u32 v = indexes[i];
+    if (stamps[v] && misses + 1 - stamps[v] <= cache) continue;
+    stamps[v] = ++misses;
+  }
+  free(stamps);
+  *acmr = count >= 3 ? (f32) misses / (count / 3) : 0;
+  *atvr = size ? (f32) misses / size : 0;
+}
+
+// Reorders the triangles inside each submesh so the ranges stay valid, the vertexes are renumbered across all of them.
+// Each range is ordered on its own local vertex numbers to keep the cost proportional to the range
+void model_optimize(Vertex* vrts, u32* indexes, u32 count, u32 size, Submesh* submeshes, u32 submesh_size) {
+  u32* local  = malloc(sizeof(u32) * MAX(size, 1));
+  u32* global = malloc(sizeof(u32) * MAX(size, 1));
+  memset(local, 0xFF, sizeof(u32) * size);
+
+  for (u32 i = 0; i < submesh_size; i++) {
+    u32* range = indexes + submeshes[i].first;
+    u32 used = 0;
+    for (u32 k = 0; k < submeshes[i].count; k++) {
+      if (local[range[k]] == (u32) -1) global[used] = range[k], local[range[k]] = used++;
+      range[k] = local[range[k]];
+    }
+    model_optimize_order(range, submeshes[i].count, used, MODEL_VERTEX_CACHE);
+    for (u32 k = 0; k < submeshes[i].count; k++) range[k] = global[range[k]];
+    for (u32 v = 0; v < used; v++) local[global[v]] = (u32) -1;
+  }
+  model_optimize_fetch(vrts, indexes, count, size);
+
+  free(local);
+  free(global);
+}
+
+// Turns the triangle list into unique vertexes plus an index buffer, u16 when the vertexes fit
+void model_index(Model* model, u8 optimized) {
+  u32* indexes = malloc(sizeof(u32) * MAX(model->size, 1));
+  model->count = model->size;
+  model->size  = model_weld(model->vertexes, model->count, indexes);
+  if (optimized) model_optimize(model->vertexes, indexes, model->count, model->size, model->submeshes, model->submesh_size);
+  model->vertexes = realloc(model->vertexes, sizeof(Vertex) * MAX(model->size, 1));
+  model->indexes = indexes;
+  model->index_type = GL_UNSIGNED_INT;
+  if (model->size > 1 << 16) return;
+
+  u16* shorts = malloc(sizeof(u16) * MAX(model->count, 1));
+  for (u32 i = 0; i < model->count; i++) shorts[i] = indexes[i];
+  free(indexes);
+  model->indexes = shorts;
+  model->index_type = GL_UNSIGNED_SHORT;
+}
+
+u32 pack_oct_normal(vec3 nrm) {
+  f32 l1 = fabsf(nrm[0]) + fabsf(nrm[1]) + fabsf(nrm[2]);
+  f32 x = l1 ? nrm[0] / l1 : 0;
+  f32 y = l1 ? nrm[1] / l1 : 0;
+  if (nrm[2] < 0) {
+    f32 t = x;
+    x = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+    y = (1 - fabsf(t)) * (y >= 0 ? 1 : -1);
+  }
+  return ((u32) (i32) roundf(x * 511) & 0x3FF) | (((u32) (i32) roundf(y * 511) & 0x3FF) << 10);
+}
+
+// Swaps the float vertexes for PackedVertex ones in place, the bounds go to model->packing for the shader
+void model_pack(Model* model) {
+  VertexPacking* p = &model->packing;
+  vec3 min = { 0, 0, 0 }, max = { 0, 0, 0 };
+  vec2 tex_max = { 0, 0 };
+  memset(p, 0, sizeof(VertexPacking));
+
+  for (u32 i = 0; i < model->size; i++) {
+    Vertex* v = &model->vertexes[i];
+    for (u8 c = 0; c < 3; c++) {
+      min[c] = i ? MIN(min[c], (*v)[c]) : (*v)[c];
+      max[c] = i ? MAX(max[c], (*v)[c]) : (*v)[c];
+    }
+    for (u8 c = 0; c < 2; c++) {
+      p->tex_min[c] = i ? MIN(p->tex_min[c], (*v)[6 + c]) : (*v)[6 + c];
+      tex_max[c]    = i ? MAX(tex_max[c],    (*v)[6 + c]) : (*v)[6 + c];
+    }
+  }
+  for (u8 c = 0; c < 3; c++) {
+    p->pos_cen[c] = (min[c] + max[c]) / 2;
+    p->pos_ext[c] = max[c] > min[c] ? (max[c] - min[c]) / 2 : 1;
+  }
+  for (u8 c = 0; c < 2; c++) p->tex_ext[c] = tex_max[c] > p->tex_min[c] ? tex_max[c] - p->tex_min[c] : 1;
+
+  for (u32 i = 0; i < model->size; i++) {
+    Vertex v;
+    PackedVertex packed = { { 0, 0, 0, 0 }, 0, { 0, 0 } };
+    memcpy(v, model->vertexes[i], sizeof(Vertex));
+    for (u8 c = 0; c < 3; c++) packed.pos[c] = roundf(CLAMP(-1, (v[c] - p->pos_cen[c]) / p->pos_ext[c], 1) * 32767);
+    for (u8 c = 0; c < 2; c++) packed.tex[c] = roundf(CLAMP(0, (v[6 + c] - p->tex_min[c]) / p->tex_ext[c], 1) * 65535);
+    packed.nrm = pack_oct_normal(&v[3]);
+    memcpy((u8*) model->vertexes + sizeof(PackedVertex) * i, &packed, sizeof(PackedVertex));
+  }
+
+  model->vertexes = realloc(model->vertexes, sizeof(PackedVertex) * MAX(model->size, 1));
+  model->layout = VERTEX_PACKED;
+  model->packed = 1;
+}
+
+// Mesh cache
+
+#define MESH_MAGIC   0x4853454D
+#define MESH_VERSION 4
+
+// Written next to the .obj as <name>-<variant>.mesh, followed by the submeshes, the vertex data and then the index data, exactly as they are uploaded
+typedef struct {
+  u32 magic, version;
+  i64 mtime;
+  u64 source_size;
+  f32 scale;
+  u32 indexed, optimized, packed;
+  u32 size, count, index_type, submesh_size;
+  VertexLayout layout;
+  VertexPacking packing;
+} MeshHeader;
+
+// One file per scale and config, so an .obj loaded two ways keeps both instead of each load rewriting the other
+void model_cache_path(c8* cache, u32 length, const c8* path, f32 scale, ModelConfig config) {
+  u32 len = strlen(path);
+  if (len > 4 && !strcmp(path + len - 4, ".obj")) len -= 4;
+  u8 flags[] = { config.indexed, config.optimized, config.packed };
+  u32 variant = canvas_hash_continue(canvas_hash(&scale, sizeof(scale)), flags, sizeof(flags));
+  snprintf(cache, length, "%.*s-%08x.mesh", len, path, variant);
+}
+
+u64 model_cache_bytes(MeshHeader* header) {
+  return sizeof(MeshHeader) + (u64) header->submesh_size * sizeof(Submesh) + (u64) header->size * header->layout.stride + (u64) header->count * (header->index_type == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32));
+}
+
+// Maps a .mesh straight into the model, fails when it's missing or was made from another .obj, scale or config
+u8 model_load_cache(Model* model, const c8* path, f32 scale, ModelConfig config) {
+  struct stat info;
+  if (stat(path, &info)) return 0;
+
+  c8 cache[512];
+  model_cache_path(cache, sizeof(cache), path, scale, config);
+  File file = canvas_map_file(cache);
+  if (!file.data) return 0;
+
+  MeshHeader* header = (MeshHeader*) file.data;
+  if (file.size < sizeof(MeshHeader) || header->magic != MESH_MAGIC || header->version != MESH_VERSION ||
+      header->mtime != info.st_mtime || header->source_size != info.st_size ||
+      header->scale != scale || header->indexed != config.indexed || header->optimized != config.optimized || header->packed != config.packed || model_cache_bytes(header) != file.size) {
+    canvas_unmap_file(file);
+    return 0;
+  }
+
+  model->size         = header->size;
+  model->count        = header->count;
+  model->index_type   = header->index_type;
+  model->packed       = header->packed;
+  model->layout       = header->layout;
+  model->packing      = header->packing;
+  model->submesh_size = header->submesh_size;
+  model->submeshes    = (Submesh*) (file.data + sizeof(MeshHeader));
+  model->vertexes     = (Vertex*) (model->submeshes + header->submesh_size);
+  model->indexes      = (u8*) model->vertexes + header->size * header->layout.stride;
+  model->cache        = file;
+  return 1;
+}
+
+void model_save_cache(Model* model, const c8* path, f32 scale, ModelConfig config) {
+  struct stat info;
+  if (stat(path, &info)) return;
+
+  MeshHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic        = MESH_MAGIC;
+  header.version      = MESH_VERSION;
+  header.mtime        = info.st_mtime;
+  header.source_size  = info.st_size;
+  header.scale        = scale;
+  header.indexed      = config.indexed;
+  header.optimized    = config.optimized;
+  header.packed       = config.packed;
+  header.size         = model->size;
+  header.count        = model->count;
+  header.index_type   = model->index_type;
+  header.submesh_size = model->submesh_size;
+  header.layout       = model->layout;
+  header.packing      = model->packing;
+
+  c8 cache[512];
+  model_cache_path(cache, sizeof(cache), path, scale, config);
+  File chunks[] = {
+    { (c8*) &header,          sizeof(header), 0 },
+    { (c8*) model->submeshes, sizeof(Submesh) * model->submesh_size, 0 },
+    { (c8*) model->vertexes,  model->layout.stride * model->size, 0 },
+    { (c8*) model->indexes,   model->count * MODEL_INDEX_SIZE(model), 0 },
+  };
+  canvas_write_file(cache, chunks, 4);
+}
+
+// Parses, indexes and writes the .mesh of an .obj without touching GL
+void model_cook(const c8* path, f32 scale, ModelConfig config) {
+  Model model;
+  memset(&model, 0, sizeof(model));
+  model.vertexes = model_parse(path, &model.size, &model.submeshes, &model.submesh_size, scale, config.threads);
+  model.layout = VERTEX_FLOAT;
+  if (config.indexed) model_index(&model, config.optimized);
+  if (config.packed)  model_pack(&model);
+  model_save_cache(&model, path, scale, config);
+  free(model.vertexes);
+  free(model.indexes);
+  free(model.submeshes);
+}
+
+void model_upload(Model* model) {
+  model->VAO = canvas_create_VAO();
+  model->VBO = canvas_create_VBO(model->size * model->layout.stride, model->vertexes, GL_STATIC_DRAW);
+  if (model->count) model->EBO = canvas_create_EBO(model->count * MODEL_INDEX_SIZE(model), model->indexes, GL_STATIC_DRAW);
+  for (u8 i = 0; i < model->layout.amount; i++) {
+    VertexAttrib* attrib = &model->layout.attribs[i];
+    canvas_vertex_attrib_pointer(attrib->location, attrib->amount, attrib->type, attrib->normalize, model->layout.stride, (void*) (u64) attrib->offset);
+  }
+}
+
+// Everything model_create does before touching GL, so it can run on any thread
+void model_load(Model* model, const c8* path, f32 scale, ModelConfig config) {
+  if (config.cache && model_load_cache(model, path, scale, config)) return;
+
+  model->vertexes = model_parse(path, &model->size, &model->submeshes, &model->submesh_size, scale, config.threads);
+  model->layout = VERTEX_FLOAT;
+  if (config.indexed) model_index(model, config.optimized);
+  if (config.packed)  model_pack(model);
+  if (config.cache) model_save_cache(model, path, scale, config);
+}
+
+Model* model_create(const c8* path, f32 scale, Material** materials, ModelConfig config) {
+  Model* model = calloc(1, sizeof(Model));
+  model->materials = materials;
+  model_load(model, path, scale, config);
+  model_upload(model);
+  return model;
+}
+
+void model_bind(Model* model, u32 shader, u8 material) {
+  if (material) canvas_set_material(shader, *model->materials[material - 1]);
+  glm_mat4_identity(model->model);
+}
+
+void model_use(Model* model, u32 shader) {
+  blocks_flush();
+  canvas_bind_buffer(GL_ARRAY_BUFFER, model->VBO);
+  canvas_bind_vao(model->VAO);
+  canvas_unim4(shader, "MODEL", model->model[0]);
+  canvas_uni1i(shader, "PACKED", model->packed);
+  if (model->packed) {
+    VertexPacking* p = &model->packing;
+    canvas_uni3f(shader, "PACKED_POS_CEN", p->pos_cen[0], p->pos_cen[1], p->pos_cen[2]);
+    canvas_uni3f(shader, "PACKED_POS_EXT", p->pos_ext[0], p->pos_ext[1], p->pos_ext[2]);
+    canvas_uni2f(shader, "PACKED_TEX_MIN", p->tex_min[0], p->tex_min[1]);
+    canvas_uni2f(shader, "PACKED_TEX_EXT", p->tex_ext[0], p->tex_ext[1]);
+  }
+}
+
+void model_draw_range(Model* model, u32 first, u32 count) {
+  if (model->EBO) glDrawElements(GL_TRIANGLES, count, model->index_type, (void*) (u64) (first * MODEL_INDEX_SIZE(model)));
+  else            glDrawArrays(GL_TRIANGLES, first, count);
+}
+
+void model_draw(Model* model, u32 shader) {
+  if (!model->VAO) return;
+  model_use(model, shader);
+  model_draw_range(model, 0, model->count ? model->count : model->size);
+}
+
+void model_draw_submesh(Model* model, u32 shader, u32 submesh) {
+  if (!model->VAO) return;
+  model_use(model, shader);
+  model_draw_range(model, model->submeshes[submesh].first, model->submeshes[submesh].count);
+}
+
+// Skips the submeshes whose box is outside the camera, neighbouring visible ones go out in the same draw. Returns how many were drawn
+u32 model_draw_visible(Model* model, u32 shader, Camera* cam) {
+  if (!model->VAO) return 0;
+  mat4 mvp;
+  vec4 planes[6];
+  glm_mat4_mul(cam->proj, cam->view, mvp);
+  glm_mat4_mul(mvp, model->model, mvp);
+  glm_frustum_planes(mvp, planes);
+  model_use(model, shader);
+
+  u32 drawn = 0, first = 0, count = 0;
+  for (u32 i = 0; i < model->submesh_size; i++) {
+    Submesh* sub = &model->submeshes[i];
+    vec3 box[2];
+    glm_vec3_copy(sub->min, box[0]);
+    glm_vec3_copy(sub->max, box[1]);
+    if (!glm_aabb_frustum(box, planes)) continue;
+
+    if (count && first + count != sub->first) {
+      model_draw_range(model, first, count);
+      count = 0;
+    }
+    if (!count) first = sub->first;
+    count += sub->count;
+    drawn++;
+  }
+  if (count) model_draw_range(model, first, count);
+  return drawn;
+}
+
+#define MODEL_BENCH_RUNS 10
+
+typedef struct {
+  f64 size, serial, parallel;
+  u8  threads;
+} BenchModels;
+
+void model_bench_file(const c8* path, const c8* name, void* data) {
+  BenchModels* total = data;
+  struct stat info;
+  stat(path, &info);
+
+  u32 size;
+  Vertex* serial = model_parse(path, &size, NULL, NULL, 1, 1);
+  u32* indexes = malloc(sizeof(u32) * MAX(size, 1));
+  u32 unique = model_weld(serial, size, indexes);
+  free(indexes);
+  free(serial);
+
+  f64 start = glfwGetTime();
+  for (u8 i = 0; i < MODEL_BENCH_RUNS; i++) free(model_parse(path, &size, NULL, NULL, 1, 1));
+  f64 serial_time = (glfwGetTime() - start) / MODEL_BENCH_RUNS;
+
+  start = glfwGetTime();
+  for (u8 i = 0; i < MODEL_BENCH_RUNS; i++) free(model_parse(path, &size, NULL, NULL, 1, total->threads));
+  f64 parallel_time = (glfwGetTime() - start) / MODEL_BENCH_RUNS;
+
+  total->size     += info.st_size;
+  total->serial   += serial_time;
+  total->parallel += parallel_time;
+  PRINT("%-16s %8.1f KB %8u vertexes %8u indexed %8.1f MB/s serial %8.1f MB/s parallel", name, info.st_size / 1e3, size, unique, info.st_size / serial_time / 1e6, info.st_size / parallel_time / 1e6);
+}
+
+// Times parsing every .obj in dir serially and split in threads, test/runner.c checks both give the same vertexes
+void model_bench(const c8* dir, u8 threads) {
+  BenchModels total = { 0, 0, 0, threads };
+  canvas_each_file(dir, ".obj", model_bench_file, &total);
+  PRINT("%-16s %8.1f KB %34s %8.1f MB/s serial %8.1f MB/s parallel (%u threads)", "total", total.size / 1e3, "", total.size / total.serial / 1e6, total.size / total.parallel / 1e6, threads);
+}
+
+void model_bench_cache_file(const c8* path, const c8* name, void* data) {
+  u32 count, submesh_size;
+  Submesh* submeshes;
+  Vertex* vrts = model_parse(path, &count, &submeshes, &submesh_size, 1, 0);
+  u32* indexes = malloc(sizeof(u32) * MAX(count, 1));
+  u32 size = model_weld(vrts, count, indexes);
+
+  f32 acmr, atvr, opt_acmr, opt_atvr;
+  model_cache_stats(indexes, count, size, MODEL_VERTEX_CACHE, &acmr, &atvr);
+  f64 start = glfwGetTime();
+  model_optimize(vrts, indexes, count, size, submeshes, submesh_size);
+  f64 time = glfwGetTime() - start;
+  model_cache_stats(indexes, count, size, MODEL_VERTEX_CACHE, &opt_acmr, &opt_atvr);
+
+  PRINT("%-16s %8u triangles %4u submeshes ACMR %5.3f -> %5.3f ATVR %5.3f -> %5.3f in %6.2f ms", name, count / 3, submesh_size, acmr, opt_acmr, atvr, opt_atvr, time * 1e3);
+  free(submeshes);
+  free(indexes);
+  free(vrts);
+}
+
+// Reports the post-transform cache misses of every .obj in the folder in exporter order and after model_optimize
+void model_bench_cache(const c8* dir) {
+  canvas_each_file(dir, ".obj", model_bench_cache_file, NULL);
+}
+
+// Loader
+
+#define LOADER_THREADS       4
+#define LOADER_QUEUE         256
+#define LOADER_STREAM_BUDGET (256 << 10)
+#define LOADER_RING          (LOADER_STREAM_BUDGET * 8)
+#define LOADER_STREAM_TAIL   32
+
+// Bounded multi-producer multi-consumer ring (Vyukov), each cell's sequence says whose turn it is
+typedef struct {
+  _Atomic u32 sequence;
+  void* data;
+} LoaderCell;
+
+typedef struct {
+  LoaderCell cells[LOADER_QUEUE];
+  _Atomic u32 head, tail;
+} LoaderQueue;
+
+void loader_queue_init(LoaderQueue* queue) {
+  for (u32 i = 0; i < LOADER_QUEUE; i++) atomic_init(&queue->cells[i].sequence, i);
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+u8 loader_queue_push(LoaderQueue* queue, void* data) {
+  u32 pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  for (;;) {
+    LoaderCell* cell = &queue->cells[pos & (LOADER_QUEUE - 1)];
+    i32 diff = atomic_load_explicit(&cell->sequence, memory_order_acquire) - pos;
+    if (diff < 0) return 0;
+    if (diff > 0) pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    else if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+      cell->data = data;
+      atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+      return 1;
+    }
+  }
+}
+
+void* loader_queue_pop(LoaderQueue* queue) {
+  u32 pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  for (;;) {
+    LoaderCell* cell = &queue->cells[pos & (LOADER_QUEUE - 1)];
+    i32 diff = atomic_load_explicit(&cell->sequence, memory_order_acquire) - (pos + 1);
+    if (diff < 0) return NULL;
+    if (diff > 0) pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    else if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+      void* data = cell->data;
+      atomic_store_explicit(&cell->sequence, pos + LOADER_QUEUE, memory_order_release);
+      return data;
+    }
+  }
+}
+
+typedef enum { LOAD_MODEL, LOAD_TEXTURE, LOAD_TEXTURE_ARRAY } LoadType;
+
+typedef struct {
+  LoadType type;
+  c8* path;
+  Model* model;
+  f32 scale;
+  ModelConfig model_config;
+  GLenum unit;
+  u32 texture;
+  Image image;
+  TextureConfig texture_config;
+  c8** paths;
+  Image* images;
+  u16 layers;
+  u32 offsets[32];
+  u8 level;
+  u16 layer;
+  u32 row;
+  u8* pending;
+} LoadJob;
+
+// Workers read and decode, the GL thread only uploads what they finished. Streamed textures go through the upload ring,
+// stream_budget bytes per loader_upload
+typedef struct {
+  LoaderQueue todo, done;
+  sem_t pending;
+  pthread_t threads[LOADER_THREADS];
+  u8 threads_amount;
+  u32 requested, uploaded;
+  LoadJob** streaming;
+  u32 streaming_size, streaming_capacity;
+  UploadRing* ring;
+  u32 stream_budget;
+} Loader;
+
+void* loader_work(void* arg) {
+  Loader* loader = arg;
+  for (;;) {
+    sem_wait(&loader->pending);
+    LoadJob* job = loader_queue_pop(&loader->todo);
+    if (!job) return NULL;
+
+    if      (job->type == LOAD_MODEL)   model_load(job->model, job->path, job->scale, job->model_config);
+    else if (job->type == LOAD_TEXTURE) job->image = canvas_load_texture(job->path, job->texture_config);
+    else canvas_load_textures((const c8**) job->paths, job->images, job->layers, job->texture_config);
+    while (!loader_queue_push(&loader->done, job)) sched_yield();
+  }
+}
+
+// 0 threads takes one per core up to LOADER_THREADS
+Loader* loader_create(u8 threads) {
+  Loader* loader = calloc(1, sizeof(Loader));
+  loader_queue_init(&loader->todo);
+  loader_queue_init(&loader->done);
+  sem_init(&loader->pending, 0, 0);
+  loader->threads_amount = threads ? threads : CLAMP(1, sysconf(_SC_NPROCESSORS_ONLN), LOADER_THREADS);
+  loader->stream_budget  = LOADER_STREAM_BUDGET;
+  loader->ring           = ring_create(LOADER_RING);
+  for (u8 i = 0; i < loader->threads_amount; i++) pthread_create(&loader->threads[i], NULL, loader_work, loader);
+  return loader;
+}
+
+void loader_request(Loader* loader, LoadJob* job) {
+  ASSERT(loader_queue_push(&loader->todo, job), "Too many pending loads (%s)", job->path);
+  loader->requested++;
+  sem_post(&loader->pending);
+}
+
+// The model is drawable, and skipped by the draw calls until then, once loader_upload gets to it
+Model* loader_model(Loader* loader, const c8* path, f32 scale, Material** materials, ModelConfig config) {
+  LoadJob* job = calloc(1, sizeof(LoadJob));
+  job->type         = LOAD_MODEL;
+  job->path         = strdup(path);
+  job->model        = calloc(1, sizeof(Model));
+  job->scale        = scale;
+  job->model_config = config;
+  job->model->materials = materials;
+  loader_request(loader, job);
+  return job->model;
+}
+
+// The texture name is made and bound to the unit right away, it samples black until its pixels are uploaded.
+// pending, when given, is set until the loader is done writing to the name
+u32 loader_texture(Loader* loader, GLenum unit, const c8* path, TextureConfig config, u8* pending) {
+  LoadJob* job = calloc(1, sizeof(LoadJob));
+  job->type           = LOAD_TEXTURE;
+  job->pending        = pending;
+  job->path           = strdup(path);
+  job->unit           = unit;
+  job->texture_config = config;
+  job->images         = &job->image;
+  job->layers         = 1;
+  if (pending) *pending = 1;
+  glGenTextures(1, &job->texture);
+  canvas_bind_texture(unit, GL_TEXTURE_2D, job->texture);
+  loader_request(loader, job);
+  return job->texture;
+}
+
+// Same as loader_texture for a texture array, all of its layers are decoded by one worker and uploaded together
+u32 loader_texture_array(Loader* loader, GLenum unit, const c8* paths[], u16 layers, TextureConfig config, u8* pending) {
+  LoadJob* job = calloc(1, sizeof(LoadJob));
+  job->type           = LOAD_TEXTURE_ARRAY;
+  job->pending        = pending;
+  job->path           = strdup(paths[0]);
+  job->unit           = unit;
+  job->texture_config = config;
+  job->layers         = layers;
+  job->paths          = malloc(layers * sizeof(c8*));
+  job->images         = calloc(layers, sizeof(Image));
+  for (u16 l = 0; l < layers; l++) job->paths[l] = strdup(paths[l]);
+  if (pending) *pending = 1;
+  glGenTextures(1, &job->texture);
+  canvas_bind_texture(unit, GL_TEXTURE_2D_ARRAY, job->texture);
+  loader_request(loader, job);
+  return job->texture;
+}
+
+void loader_free(LoadJob* job) {
+  if (job->pending) *job->pending = 0;
+  if (job->type == LOAD_TEXTURE) canvas_free_image(job->image);
+  if (job->type == LOAD_TEXTURE_ARRAY) {
+    for (u16 l = 0; l < job->layers; l++) {
+      canvas_free_image(job->images[l]);
+      free(job->paths[l]);
+    }
+    free(job->images);
+    free(job->paths);
+  }
+  free(job->path);
+  free(job);
+}
+
+// Copies the bytes into the upload ring, left bound as the unpack buffer. Returns the offset the upload reads them from
+void* loader_pbo(Loader* loader, const void* data, u32 size) {
+  u32 offset;
+  memcpy(ring_map(loader->ring, size, 4, &offset), data, size);
+  ring_unmap(loader->ring);
+  canvas_bind_buffer(GL_PIXEL_UNPACK_BUFFER, loader->ring->buffer);
+  return (void*) (uintptr_t) offset;
+}
+
+// Uploads the rows of the finest level still missing until budget bytes are spent, at least one row. BC1 rows are 4 texels tall.
+// A level becomes the base once all of its layers are in. Returns the bytes used
+u32 loader_stream(Loader* loader, LoadJob* job, u32 budget) {
+  Image* images = job->images;
+  GLenum target = job->type == LOAD_TEXTURE ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+  GLenum format = images[0].format;
+  GLint internal;
+  GLenum pixel = canvas_image_format(images[0], &internal);
+  canvas_bind_texture(job->unit, target, job->texture);
+
+  u32 used = 0;
+  while (job->level < images[0].levels && (!used || used < budget)) {
+    u32 w = MAX(images[0].width >> job->level, 1), h = MAX(images[0].height >> job->level, 1);
+    u32 row_texels = format ? 4 : 1, row_bytes = format ? (w + 3) / 4 * 8 : w * images[0].channels;
+    u32 total = (h + row_texels - 1) / row_texels;
+    u32 rows  = MIN(total - job->row, MAX((budget - MIN(used, budget)) / row_bytes, 1));
+    u32 y = job->row * row_texels, height = MIN(rows * row_texels, h - y);
+
+    void* pixels = loader_pbo(loader, images[job->layer].pixels + job->offsets[job->level] + sizeof(u32) + job->row * row_bytes, rows * row_bytes);
+    if (target == GL_TEXTURE_2D) {
+      if (format) glCompressedTexSubImage2D(target, job->level, 0, y, w, height, format, rows * row_bytes, pixels);
+      else        glTexSubImage2D(target, job->level, 0, y, w, height, pixel, GL_UNSIGNED_BYTE, pixels);
+    }
+    else {
+      if (format) glCompressedTexSubImage3D(target, job->level, 0, y, job->layer, w, height, 1, format, rows * row_bytes, pixels);
+      else        glTexSubImage3D(target, job->level, 0, y, job->layer, w, height, 1, pixel, GL_UNSIGNED_BYTE, pixels);
+    }
+    used     += rows * row_bytes;
+    job->row += rows;
+
+    if (job->row < total) continue;
+    job->row = 0;
+    if (++job->layer < job->layers) continue;
+    job->layer = 0;
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, job->level);
+    if (!job->level) job->level = images[0].levels;
+    else             job->level--;
+  }
+  canvas_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return used;
+}
+
+// Allocates every level and uploads the ones no bigger than LOADER_STREAM_TAIL, so the texture samples its coarse mips right away
+void loader_stream_begin(Loader* loader, LoadJob* job) {
+  Image* images = job->images;
+  Image first = images[0];
+  u16 layers = job->layers;
+  for (u16 l = 1; l < layers; l++)
+    ASSERT(images[l].width == first.width && images[l].height == first.height && images[l].format == first.format && images[l].levels == first.levels && images[l].channels == first.channels,
+           "Texture array layer %u is %ux%u, the first one is %ux%u", l, images[l].width, images[l].height, first.width, first.height);
+
+  GLenum target = job->type == LOAD_TEXTURE ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+  canvas_bind_texture(job->unit, target, job->texture);
+  canvas_texture_parameters(target, job->texture_config);
+  canvas_texture_swizzle(target, first);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  GLint internal;
+  GLenum format = canvas_image_format(first, &internal);
+  u32 offset = 0, tail = 0;
+  for (u8 i = 0; i < first.levels; i++) {
+    u32 size, w = MAX(first.width >> i, 1), h = MAX(first.height >> i, 1);
+    memcpy(&size, first.pixels + offset, sizeof(u32));
+    job->offsets[i] = offset;
+    offset += sizeof(u32) + size;
+    if (w <= LOADER_STREAM_TAIL && h <= LOADER_STREAM_TAIL) tail += size * layers;
+
+    if (target == GL_TEXTURE_2D) {
+      if (first.format) glCompressedTexImage2D(target, i, first.format, w, h, 0, size, NULL);
+      else              glTexImage2D(target, i, internal, w, h, 0, format, GL_UNSIGNED_BYTE, NULL);
+    }
+    else {
+      if (first.format) glCompressedTexImage3D(target, i, first.format, w, h, layers, 0, size * layers, NULL);
+      else              glTexImage3D(target, i, internal, w, h, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+    }
+  }
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,  first.levels - 1);
+  glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, first.levels - 1);
+
+  job->level = first.levels - 1;
+  if (tail) loader_stream(loader, job, tail);
+}
+
+// Uploads finished loads until the budget (in seconds) runs out, at least one per call, then streams up to stream_budget bytes
+// of the streamed textures in the order they came. Returns how many loads are left, streamed ones count until they are complete
+u32 loader_upload(Loader* loader, f64 budget) {
+  f64 start = glfwGetTime();
+  LoadJob* job;
+  while ((job = loader_queue_pop(&loader->done))) {
+    if (job->type == LOAD_MODEL) model_upload(job->model);
+    else if (job->texture_config.streamed) {
+      loader_stream_begin(loader, job);
+      GROW(loader->streaming, loader->streaming_capacity, loader->streaming_size + 1);
+      loader->streaming[loader->streaming_size++] = job;
+      if (glfwGetTime() - start >= budget) break;
+      continue;
+    }
+    else if (job->type == LOAD_TEXTURE) canvas_upload_texture(job->unit, job->texture, job->image, job->texture_config);
+    else canvas_upload_texture_array(job->unit, job->texture, job->images, job->layers, job->texture_config);
+    loader_free(job);
+    loader->uploaded++;
+    if (glfwGetTime() - start >= budget) break;
+  }
+
+  u32 used = 0, done = 0;
+  for (u32 i = 0; i < loader->streaming_size; i++) {
+    job = loader->streaming[i];
+    if (used < loader->stream_budget) used += loader_stream(loader, job, loader->stream_budget - used);
+    if (job->level < job->images[0].levels) loader->streaming[done++] = job;
+    else {
+      loader_free(job);
+      loader->uploaded++;
+    }
+  }
+  loader->streaming_size = done;
+  ring_fence(loader->ring);
+  return loader->requested - loader->uploaded;
+}
+
+void loader_finish(Loader* loader) {
+  while (loader_upload(loader, 1)) sched_yield();
+}
+
+void loader_destroy(Loader* loader) {
+  loader_finish(loader);
+  for (u8 i = 0; i < loader->threads_amount; i++) sem_post(&loader->pending);
+  for (u8 i = 0; i < loader->threads_amount; i++) pthread_join(loader->threads[i], NULL);
+  sem_destroy(&loader->pending);
+  ring_destroy(loader->ring);
+  free(loader->streaming);
+  free(loader);
+}
+
+// Texture registry
+
+// One GL texture for every load of the same path and config, deleted when the last of them is unloaded.
+// Arrays are keyed by their paths joined with newlines
+typedef struct {
+  c8* path;
+  TextureConfig config;
+  GLenum unit, target;
+  u32 texture, hash, refs;
+  u16 layers;
+  u8  pending;
+} Texture;
+
+// Loads go through the loader when there is one
+typedef struct {
+  Texture** textures;
+  u32 size, capacity;
+  Loader* loader;
+} TextureRegistry;
+
+TextureRegistry* registry_create(Loader* loader) {
+  TextureRegistry* registry = calloc(1, sizeof(TextureRegistry));
+  registry->loader = loader;
+  return registry;
+}
+
+u8 texture_config_equal(TextureConfig a, TextureConfig b) {
+  return a.wrap_s == b.wrap_s && a.wrap_t == b.wrap_t && a.min_filter == b.min_filter && a.mag_filter == b.mag_filter &&
+         a.compressed == b.compressed && a.keyed == b.keyed && (!a.keyed || !memcmp(a.key, b.key, 3)) && a.filter == b.filter;
+}
+
+Texture* registry_lookup(TextureRegistry* registry, const c8* key, TextureConfig config) {
+  u32 hash = canvas_hash(key, strlen(key));
+  for (u32 i = 0; i < registry->size; i++) {
+    Texture* texture = registry->textures[i];
+    if (texture->hash == hash && !strcmp(texture->path, key) && texture_config_equal(texture->config, config)) return texture;
+  }
+  return NULL;
+}
+
+// Hands out another reference to a texture already loaded with the same key. A texture stays on the unit it was loaded to,
+// texture_bytes, table_ready and the LAYERS sampler all rebind it there, so asking for it on another one is refused
+Texture* registry_find(TextureRegistry* registry, GLenum unit, const c8* key, TextureConfig config) {
+  Texture* texture = registry_lookup(registry, key, config);
+  if (!texture) return NULL;
+  ASSERT(unit == texture->unit, "Texture %.*s is on unit %u, can't share it on unit %u", (i32) strcspn(key, "\n"), key, texture->unit - GL_TEXTURE0, unit - GL_TEXTURE0);
+  texture->refs++;
+  return texture;
+}
+
+Texture* registry_add(TextureRegistry* registry, GLenum unit, GLenum target, const c8* key, TextureConfig config, u16 layers) {
+  GROW(registry->textures, registry->capacity, registry->size + 1);
+  Texture* texture = calloc(1, sizeof(Texture));
+  texture->path   = strdup(key);
+  texture->config = config;
+  texture->unit   = unit;
+  texture->target = target;
+  texture->hash   = canvas_hash(key, strlen(key));
+  texture->refs   = 1;
+  texture->layers = layers;
+  registry->textures[registry->size++] = texture;
+  return texture;
+}
+
+Texture* registry_texture(TextureRegistry* registry, GLenum unit, const c8* path, TextureConfig config) {
+  Texture* texture = registry_find(registry, unit, path, config);
+  if (texture) return texture;
+
+  texture = registry_add(registry, unit, GL_TEXTURE_2D, path, config, 1);
+  texture->texture = registry->loader ? loader_texture(registry->loader, unit, path, config, &texture->pending) : canvas_create_texture(unit, texture->path, config);
+  return texture;
+}
+
+// Same as registry_texture for every texture of the batch. Without a loader the ones not in the registry are decoded in parallel first
+void registry_textures(TextureRegistry* registry, BatchTexture* batch, u32 amount, Texture** textures) {
+  if (!registry->loader) {
+    BatchTexture* missing = malloc(amount * sizeof(BatchTexture));
+    u32 size = 0;
+    for (u32 i = 0; i < amount; i++) {
+      u8 found = registry_lookup(registry, batch[i].path, batch[i].config) != NULL;
+      for (u32 m = 0; m < size && !found; m++) found = !strcmp(missing[m].path, batch[i].path) && texture_config_equal(missing[m].config, batch[i].config);
+      if (!found) missing[size++] = batch[i];
+    }
+
+    canvas_create_textures(missing, size, 0);
+    for (u32 m = 0; m < size; m++) {
+      Texture* texture = registry_add(registry, missing[m].unit, GL_TEXTURE_2D, missing[m].path, missing[m].config, 1);
+      texture->texture = missing[m].texture;
+      texture->refs    = 0;
+    }
+    free(missing);
+  }
+  for (u32 i = 0; i < amount; i++) {
+    Texture* texture = registry_texture(registry, batch[i].unit, batch[i].path, batch[i].config);
+    batch[i].texture = texture->texture;
+    if (textures) textures[i] = texture;
+  }
+}
+
+Texture* registry_texture_array(TextureRegistry* registry, GLenum unit, const c8* paths[], u16 layers, TextureConfig config) {
+  u32 length = 0;
+  for (u16 l = 0; l < layers; l++) length += strlen(paths[l]) + 1;
+  c8* key = calloc(1, length);
+  for (u16 l = 0; l < layers; l++) {
+    if (l) strcat(key, "\n");
+    strcat(key, paths[l]);
+  }
+
+  Texture* texture = registry_find(registry, unit, key, config);
+  if (!texture) {
+    texture = registry_add(registry, unit, GL_TEXTURE_2D_ARRAY, key, config, layers);
+    texture->texture = registry->loader ? loader_texture_array(registry->loader, unit, paths, layers, config, &texture->pending) : canvas_create_texture_array(unit, paths, layers, config);
+  }
+  free(key);
+  return texture;
+}
+
+// Drops a reference, the texture is deleted with the last one. One the loader is still writing to is uploaded first
+void registry_unload(TextureRegistry* registry, Texture* texture) {
+  if (--texture->refs) return;
+
+  while (texture->pending && loader_upload(registry->loader, 0)) sched_yield();
+  canvas_delete_texture(texture->texture);
+  for (u32 i = 0; i < registry->size; i++)
+    if (registry->textures[i] == texture) {
+      registry->textures[i] = registry->textures[--registry->size];
+      break;
+    }
+  free(texture->path);
+  free(texture);
+}
+
+// Bytes the texture takes on the GPU as the driver reports them, every level and layer. Binds it to its unit to ask
+u64 texture_bytes(Texture* texture, u16* width, u16* height, u8* levels) {
+  canvas_bind_texture(texture->unit, texture->target, texture->texture);
+
+  u64 bytes = 0;
+  i32 w, h, d, compressed, size, bits[4];
+  for (*levels = 0;; (*levels)++) {
+    glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_WIDTH, &w);
+    if (!w) break;
+    glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_HEIGHT, &h);
+    glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_DEPTH, &d);
+    glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_COMPRESSED, &compressed);
+    if (!*levels) *width = w, *height = h;
+
+    if (compressed) glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+    else {
+      glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_RED_SIZE,   &bits[0]);
+      glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_GREEN_SIZE, &bits[1]);
+      glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_BLUE_SIZE,  &bits[2]);
+      glGetTexLevelParameteriv(texture->target, *levels, GL_TEXTURE_ALPHA_SIZE, &bits[3]);
+      size = (u64) w * h * d * (bits[0] + bits[1] + bits[2] + bits[3]) / 8;
+    }
+    bytes += size;
+  }
+  return bytes;
+}
+
+// Prints every texture with its unit, references, size and memory, returns the total bytes. Pending loads count as empty
+u64 registry_stats(TextureRegistry* registry) {
+  u64 total = 0;
+  for (u32 i = 0; i < registry->size; i++) {
+    Texture* texture = registry->textures[i];
+    u16 width = 0, height = 0;
+    u8 levels;
+    u64 bytes = texture_bytes(texture, &width, &height, &levels);
+    total += bytes;
+
+    u32 name = strcspn(texture->path, "\n");
+    PRINT("%-20.*s unit %2u %3u refs %4ux%-4u x %2u layers %u levels %8.1f KB", name, texture->path, texture->unit - GL_TEXTURE0, texture->refs,
+          width, height, texture->layers, levels, bytes / 1e3);
+  }
+  PRINT("%u textures %.1f KB", registry->size, total / 1e3);
+  return total;
+}
+
+// Deletes every texture whatever its references, after the loader is done with the ones it's still writing to
+void registry_destroy(TextureRegistry* registry) {
+  for (u32 i = 0; i < registry->size; i++) {
+    while (registry->textures[i]->pending && loader_upload(registry->loader, 0)) sched_yield();
+    canvas_delete_texture(registry->textures[i]->texture);
+    free(registry->textures[i]->path);
+    free(registry->textures[i]);
+  }
+  free(registry->textures);
+  free(registry);
+}
+
+// Material table
+
+#define TABLE_SIZE    64
+#define TABLE_BINDING 0
+
+typedef enum { SLOT_COLOR, SLOT_TEXTURE, SLOT_LAYER } SlotKind;
+
+// What the shader reads for one map, std140. A bindless handle, or an RGBA8 color in handle[0], and the layer for arrays
+typedef struct {
+  u32 handle[2];
+  i32 layer, kind;
+} TableSlot;
+
+// Diffuse, specular and emission, the MAPS of an ENTRIES element in the MATERIAL_TABLE block
+typedef struct {
+  TableSlot slots[3];
+} TableEntry;
+
+typedef struct {
+  Texture* texture;
+  u16 layer;
+  u8 resolved;
+} TableSource;
+
+// Every material's maps in one uniform buffer, so a draw only changes MAT.ENT. With ARB_bindless_texture the slots are resident
+// handles, otherwise they are layers of the one array bound to LAYERS. Single texel textures become colors either way
+typedef struct {
+  u32 ubo;
+  u8 bindless;
+  TableEntry entries[TABLE_SIZE];
+  TableSource sources[TABLE_SIZE][3];
+  u32 size, pending;
+  Texture* array;
+} MaterialTable;
+
+MaterialTable* table_create() {
+  MaterialTable* table = calloc(1, sizeof(MaterialTable));
+  table->bindless = GLAD_GL_ARB_bindless_texture;
+  glGenBuffers(1, &table->ubo);
+  canvas_bind_buffer(GL_UNIFORM_BUFFER, table->ubo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(table->entries), NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, TABLE_BINDING, table->ubo);
+  return table;
+}
+
+// The preamble for shader_create_program_defines, GLSL 4.00 is the least bindless handles need
+const c8* table_defines(MaterialTable* table) {
+  return table->bindless ? "#version 400 core\n#extension GL_ARB_bindless_texture : require\n#define BINDLESS\n" : "";
+}
+
+void table_attach_program(void* data, u32 program) {
+  MaterialTable* table = data;
+  u32 block = glGetUniformBlockIndex(program, "MATERIAL_TABLE");
+  if (block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, TABLE_BINDING);
+  if (!table->array) return;
+  canvas_use_program(program);
+  canvas_uni1i(program, "LAYERS", table->array->unit - GL_TEXTURE0);
+}
+
+// Shader variants get it on the ones compiled so far and on every later one
+void table_attach(MaterialTable* table, u32 shader) {
+  ShaderVariants* variants = shader_variants(shader);
+  if (!variants) {
+    table_attach_program(table, shader);
+    return;
+  }
+  variants->attach = table_attach_program;
+  variants->attach_data = table;
+  for (u32 i = 0; i < variants->size; i++) table_attach_program(table, variants->programs[i]);
+}
+
+// Handles freeze a texture and colors need its texel, so both wait until every level is in. Streamed ones get there last
+u8 table_ready(Texture* texture) {
+  canvas_bind_texture(texture->unit, texture->target, texture->texture);
+  i32 width, base;
+  glGetTexLevelParameteriv(texture->target, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexParameteriv(texture->target, GL_TEXTURE_BASE_LEVEL, &base);
+  return width && !base;
+}
+
+// Fills the slot of a source, returns 0 when its texture isn't ready yet. A missing texture is black
+u8 table_resolve(MaterialTable* table, TableSource* source, TableSlot* slot) {
+  Texture* texture = source->texture;
+  *slot = (TableSlot) { { 0, 0 }, source->layer, SLOT_COLOR };
+  if (!texture) return 1;
+  if (texture->target == GL_TEXTURE_2D_ARRAY && !table->bindless) {
+    slot->kind = SLOT_LAYER;
+    return 1;
+  }
+  if (!table_ready(texture)) return 0;
+
+  i32 width, height;
+  glGetTexLevelParameteriv(texture->target, 0, GL_TEXTURE_WIDTH,  &width);
+  glGetTexLevelParameteriv(texture->target, 0, GL_TEXTURE_HEIGHT, &height);
+  if (texture->target == GL_TEXTURE_2D && width == 1 && height == 1) {
+    u8 texel[4];
+    i32 swizzle[4];
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    for (u8 c = 0; c < 4; c++) {
+      u32 value = swizzle[c] == GL_ZERO ? 0 : swizzle[c] == GL_ONE ? 255 : texel[swizzle[c] - GL_RED];
+      slot->handle[0] |= value << c * 8;
+    }
+    return 1;
+  }
+
+  u64 handle = glGetTextureHandleARB(texture->texture);
+  if (!glIsTextureHandleResidentARB(handle)) glMakeTextureHandleResidentARB(handle);
+  memcpy(slot->handle, &handle, sizeof(u64));
+  slot->kind = texture->target == GL_TEXTURE_2D ? SLOT_TEXTURE : SLOT_LAYER;
+  return 1;
+}
+
+// Resolves the slots still waiting on their textures and uploads the entries when any of them changed, call it once a frame
+void table_update(MaterialTable* table) {
+  if (!table->pending) return;
+  u32 changed = 0;
+  table->pending = 0;
+  for (u32 i = 0; i < table->size; i++)
+    for (u8 m = 0; m < 3; m++) {
+      TableSource* source = &table->sources[i][m];
+      if (source->resolved) continue;
+      source->resolved = table_resolve(table, source, &table->entries[i].slots[m]);
+      if (source->resolved) changed++;
+      else                  table->pending++;
+    }
+  if (!changed) return;
+  canvas_bind_buffer(GL_UNIFORM_BUFFER, table->ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, table->size * sizeof(TableEntry), table->entries);
+}
+
+// Whether a 2D texture is stored as one texel. One the loader hasn't uploaded yet is decoded to tell, shrinking like canvas_pack_images
+u8 table_single_texel(Texture* texture) {
+  if (!texture->pending) {
+    i32 width, height;
+    canvas_bind_texture(texture->unit, texture->target, texture->texture);
+    glGetTexLevelParameteriv(texture->target, 0, GL_TEXTURE_WIDTH,  &width);
+    glGetTexLevelParameteriv(texture->target, 0, GL_TEXTURE_HEIGHT, &height);
+    return width == 1 && height == 1;
+  }
+
+  Image image = canvas_load_image(texture->path);
+  u32 count = image.width * image.height, i = 1;
+  if (!texture->config.compressed || !GLAD_GL_EXT_texture_compression_s3tc)
+    while (i < count && !memcmp(image.pixels + i * 3, image.pixels, 3)) i++;
+  free(image.pixels);
+  return count == 1 || i == count;
+}
+
+// Returns the value for Material.entry. Layers only count for texture arrays, which have to be a single one without bindless textures,
+// where plain textures have to be single texels
+u8 table_add(MaterialTable* table, Texture* dif, u16 dif_layer, Texture* spc, u16 spc_layer, Texture* emt, u16 emt_layer) {
+  ASSERT(table->size < TABLE_SIZE, "Material table is full (%u entries)", TABLE_SIZE);
+  Texture* maps[3] = { dif, spc, emt };
+  u16 layers[3]    = { dif_layer, spc_layer, emt_layer };
+  for (u8 m = 0; m < 3; m++) {
+    if (maps[m] && maps[m]->target == GL_TEXTURE_2D_ARRAY && !table->bindless) {
+      ASSERT(!table->array || table->array == maps[m], "Without bindless textures every layer has to come from one array (%s)", maps[m]->path);
+      table->array = maps[m];
+    }
+    if (maps[m] && maps[m]->target == GL_TEXTURE_2D && !table->bindless)
+      ASSERT(table_single_texel(maps[m]), "Without bindless textures the material table only takes array layers and single texels (%s)", maps[m]->path);
+    table->sources[table->size][m] = (TableSource) { maps[m], layers[m], 0 };
+  }
+  table->pending += 3;
+  table->size++;
+  table_update(table);
+  return table->size;
+}
+
+void table_destroy(MaterialTable* table) {
+  for (u32 i = 0; i < table->size; i++)
+    for (u8 m = 0; m < 3; m++) {
+      TableSlot* slot = &table->entries[i].slots[m];
+      if (!table->bindless || slot->kind == SLOT_COLOR || !table->sources[i][m].resolved) continue;
+      u64 handle;
+      memcpy(&handle, slot->handle, sizeof(u64));
+      if (glIsTextureHandleResidentARB(handle)) glMakeTextureHandleNonResidentARB(handle);
+    }
+  canvas_delete_buffer(table->ubo);
+  free(table);
+}
+
+// Light
+
+typedef struct {
+  vec3 col, dir;
+} DirLig;
+
+typedef struct {
+  vec3 col, pos;
+  f32  con, lin, qua;
+} PntLig;
 
 typedef struct {
   vec3 col, pos, dir;
   f32  con, lin, qua, inn, out;
 } SptLig;
 
-void canvas_set_dir_lig(u32 shader, DirLig dir_lig, u32 i) {
-  char uniform[255];
-  sprintf(uniform, "DIR_LIGS[%i].COL", i);
-  canvas_uni3f(shader, uniform, dir_lig.col[0], dir_lig.col[1], dir_lig.col[2]);
-  sprintf(uniform, "DIR_LIGS[%i].DIR", i);
-  canvas_uni3f(shader, uniform, dir_lig.dir[0], dir_lig.dir[1], dir_lig.dir[2]);
-}
-
-void canvas_set_pnt_lig(u32 shader, PntLig pnt_lig, u32 i) {
-  char uniform[255];
-  sprintf(uniform, "PNT_LIGS[%i].COL", i);
-  canvas_uni3f(shader, uniform, pnt_lig.col[0], pnt_lig.col[1], pnt_lig.col[2]);
-  sprintf(uniform, "PNT_LIGS[%i].POS", i);
-  canvas_uni3f(shader, uniform, pnt_lig.pos[0], pnt_lig.pos[1], pnt_lig.pos[2]);
-  sprintf(uniform, "PNT_LIGS[%i].CON", i);
-  canvas_uni1f(shader, uniform, pnt_lig.con);
-  sprintf(uniform, "PNT_LIGS[%i].LIN", i);
-  canvas_uni1f(shader, uniform, pnt_lig.lin);
-  sprintf(uniform, "PNT_LIGS[%i].QUA", i);
-  canvas_uni1f(shader, uniform, pnt_lig.qua);
-}
-
-void canvas_set_spt_lig(u32 shader, SptLig spt_lig, u32 i) {
-  char uniform[255];
-  sprintf(uniform, "SPT_LIGS[%i].COL", i);
-  canvas_uni3f(shader, uniform, spt_lig.col[0], spt_lig.col[1], spt_lig.col[2]);
-  sprintf(uniform, "SPT_LIGS[%i].POS", i);
-  canvas_uni3f(shader, uniform, spt_lig.pos[0], spt_lig.pos[1], spt_lig.pos[2]);
-  sprintf(uniform, "SPT_LIGS[%i].DIR", i);
-  canvas_uni3f(shader, uniform, spt_lig.dir[0], spt_lig.dir[1], spt_lig.dir[2]);
-  sprintf(uniform, "SPT_LIGS[%i].CON", i);
-  canvas_uni1f(shader, uniform, spt_lig.con);
-  sprintf(uniform, "SPT_LIGS[%i].LIN", i);
-  canvas_uni1f(shader, uniform, spt_lig.lin);
-  sprintf(uniform, "SPT_LIGS[%i].QUA", i);
-  canvas_uni1f(shader, uniform, spt_lig.qua);
-  sprintf(uniform, "SPT_LIGS[%i].INN", i);
-  canvas_uni1f(shader, uniform, spt_lig.inn);
-  sprintf(uniform, "SPT_LIGS[%i].OUT", i);
-  canvas_uni1f(shader, uniform, spt_lig.out);
+// Lights live in the LIGHTS block shared by every program
+void canvas_set_dir_lig(DirLig dir_lig, u32 i) {
+  ASSERT(i < LIGHT_AMOUNT, "Directional light %u is past LIGHT_AMOUNT", i);
+  LightBlock* lights = blocks_lights();
+  glm_vec3_copy(dir_lig.col, lights->dir[i].col);
+  glm_vec3_copy(dir_lig.dir, lights->dir[i].dir);
+  lights->dir_count = MAX(lights->dir_count, (i32) i + 1);
+}
+
+void canvas_set_pnt_lig(PntLig pnt_lig, u32 i) {
+  ASSERT(i < LIGHT_AMOUNT, "Point light %u is past LIGHT_AMOUNT", i);
+  LightBlock* lights = blocks_lights();
+  PntLigBlock* lig = &lights->pnt[i];
+  glm_vec3_copy(pnt_lig.col, lig->col);
+  glm_vec3_copy(pnt_lig.pos, lig->pos);
+  lig->con = pnt_lig.con;
+  lig->lin = pnt_lig.lin;
+  lig->qua = pnt_lig.qua;
+  lights->pnt_count = MAX(lights->pnt_count, (i32) i + 1);
+}
+
+void canvas_set_pnt_lig_col(u32 i, f32 r, f32 g, f32 b) {
+  ASSERT(i < LIGHT_AMOUNT, "Point light %u is past LIGHT_AMOUNT", i);
+  glm_vec3_copy((vec3) { r, g, b }, blocks_lights()->pnt[i].col);
+}
+
+void canvas_set_pnt_lig_pos(u32 i, f32 x, f32 y, f32 z) {
+  ASSERT(i < LIGHT_AMOUNT, "Point light %u is past LIGHT_AMOUNT", i);
+  glm_vec3_copy((vec3) { x, y, z }, blocks_lights()->pnt[i].pos);
+}
+
+void canvas_set_spt_lig(SptLig spt_lig, u32 i) {
+  ASSERT(i < LIGHT_AMOUNT, "Spot light %u is past LIGHT_AMOUNT", i);
+  LightBlock* lights = blocks_lights();
+  SptLigBlock* lig = &lights->spt[i];
+  glm_vec3_copy(spt_lig.col, lig->col);
+  glm_vec3_copy(spt_lig.pos, lig->pos);
+  glm_vec3_copy(spt_lig.dir, lig->dir);
+  lig->con = spt_lig.con;
+  lig->lin = spt_lig.lin;
+  lig->qua = spt_lig.qua;
+  lig->inn = spt_lig.inn;
+  lig->out = spt_lig.out;
+  lights->spt_count = MAX(lights->spt_count, (i32) i + 1);
 }
 
 // Text ( BETA )
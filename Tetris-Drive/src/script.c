@@ -9,6 +9,11 @@
 #define SENSITIVITY 0.001
 #define CAMERA_LOCK PI2 * 0.99
 #define FOV PI4 * 0.7
+#define BENCHMARK 0
+#define UPLOAD_BUDGET 2e-3
+#define TEXTURE_STATS 0
+#define FRAME_STATS 0
+#define SHADER_STATS 0
 
 #define LOADED_SCENARIOS 3
 #define SCENARIO_SIZE 50
@@ -20,16 +25,23 @@ f32 fps, tick = 0;
 vec3 mouse;
 u32 shader;
 
-Material m_street    = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 2,  0, 1, 0, 0 };
-Material m_grass     = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.1, 255, 3,  0, 1, 0, 0 };
-Material m_bush      = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 4,  0, 1, 0, 1 };
-Material m_tree      = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 5,  0, 1, 0, 1 };
-Material m_car       = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 6,  0, 1, 0, 1 };
-Material m_inc_car_1 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 7,  0, 1, 0, 1 };
-Material m_inc_car_2 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 8,  0, 1, 0, 1 };
-Material m_inc_car_3 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 9,  0, 1, 0, 1 };
-Material m_inc_car_4 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 10, 0, 1, 0, 1 };
-Material m_inc_car_5 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 11, 0, 1, 0, 1 };
+// Foliage and the car cut out their green, cooked as transparent texels so BC1 can't shift it. Streamed in coarsest mip first
+TextureConfig t_keyed = { GL_MIRRORED_REPEAT, GL_MIRRORED_REPEAT, GL_NEAREST, GL_NEAREST, 1, 1, { 0, 255, 0 }, MIP_BOX, 1 };
+
+// Every 128x128 texture shares one texture array, material table entry n samples layers[n - 1]
+const c8* layers[] = { "img/street.ppm", "img/grass.ppm", "img/bush.ppm", "img/tree.ppm", "img/car.ppm",
+                       "img/car-1.ppm", "img/car-2.ppm", "img/car-3.ppm", "img/car-4.ppm", "img/car-5.ppm" };
+
+Material m_street    = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 0, 0, 1, 0, 0, 0, 1  };
+Material m_grass     = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.1, 255, 0, 0, 1, 0, 0, 0, 2  };
+Material m_bush      = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 0, 0, 1, 0, 1, 0, 3  };
+Material m_tree      = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.0, 255, 0, 0, 1, 0, 1, 0, 4  };
+Material m_car       = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 5  };
+Material m_inc_car_1 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 6  };
+Material m_inc_car_2 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 7  };
+Material m_inc_car_3 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 8  };
+Material m_inc_car_4 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 9  };
+Material m_inc_car_5 = { { 1.00, 1.00, 1.00 }, 0.5, 0.5, 0.5, 255, 0, 0, 1, 0, 1, 0, 10 };
 
 
 Material m_track   = { { 0.90, 1.00, 0.35 }, 0.0, 0.0, 0.0, 000, 0, 0, 1, 1, 0 };
@@ -78,7 +90,7 @@ void move_car() {
   p_car.d_spd = CLAMP(0, p_car.spd + p_car.acc / fps, p_car.max_spd) - p_car.spd;
   p_car.spd += p_car.d_spd;
   cam.fov = FOV + p_car.spd * 3e-1;
-  generate_proj_mat(&cam, shader);
+  generate_proj_mat(&cam);
   scenario_offset += p_car.spd * cos(p_car.dir);
 
   if (scenario_offset <= SCENARIO_SIZE) return;
@@ -226,43 +238,53 @@ void main() {
   glfwSetKeyCallback(cam.window, handle_keys);
   srand(time(0));
 
-  Model* street  = model_create("obj/street.obj", 1e-1, ms_street);
-  Model* grass   = model_create("obj/grass.obj",  1e-1, ms_grass);
-  Model* bushes  = model_create("obj/bushes.obj", 1e-1, ms_bush);
-  Model* trees   = model_create("obj/trees.obj",  1e-1, ms_tree);
-  Model* car     = model_create("obj/car.obj",    1,    ms_car);
-  Model* cube    = model_create("obj/cube.obj",   1,    ms_cube);
+  if (BENCHMARK) {
+    model_bench("obj", MODEL_PARSE_THREADS);
+    model_bench_cache("obj");
+    canvas_bench_images("img");
+    canvas_bench_textures("img");
+    canvas_bench_mips("img");
+    canvas_bench_batch("img");
+    glfwTerminate();
+    return;
+  }
+
+  Loader* loader = loader_create(0);
+
+  Model* street  = loader_model(loader, "obj/street.obj", 1e-1, ms_street, MODEL_PACKED);
+  Model* grass   = loader_model(loader, "obj/grass.obj",  1e-1, ms_grass,  MODEL_PACKED);
+  Model* bushes  = loader_model(loader, "obj/bushes.obj", 1e-1, ms_bush,   MODEL_PACKED);
+  Model* trees   = loader_model(loader, "obj/trees.obj",  1e-1, ms_tree,   MODEL_PACKED);
+  Model* car     = loader_model(loader, "obj/car.obj",    1,    ms_car,    MODEL_DEFAULT);
+  Model* cube    = loader_model(loader, "obj/cube.obj",   1,    ms_cube,   MODEL_DEFAULT);
   Model* inc_cars[5] = {
-    model_create("obj/car-1.obj", 1, ms_inc_car),
-    model_create("obj/car-2.obj", 1, ms_inc_car),
-    model_create("obj/car-3.obj", 1, ms_inc_car),
-    model_create("obj/car-4.obj", 1, ms_inc_car),
-    model_create("obj/car-5.obj", 1, ms_inc_car)
+    loader_model(loader, "obj/car-1.obj", 1, ms_inc_car, MODEL_DEFAULT),
+    loader_model(loader, "obj/car-2.obj", 1, ms_inc_car, MODEL_DEFAULT),
+    loader_model(loader, "obj/car-3.obj", 1, ms_inc_car, MODEL_DEFAULT),
+    loader_model(loader, "obj/car-4.obj", 1, ms_inc_car, MODEL_DEFAULT),
+    loader_model(loader, "obj/car-5.obj", 1, ms_inc_car, MODEL_DEFAULT)
   };
 
   u32 lowres_fbo = canvas_create_FBO(cam.width * UPSCALE, cam.height * UPSCALE, GL_NEAREST, GL_NEAREST);
   u32 drive_fbo  = canvas_create_FBO(cam.width, cam.height, GL_NEAREST, GL_NEAREST);
   u32 tetris_fbo = canvas_create_FBO(cam.width, cam.height, GL_NEAREST, GL_NEAREST);
 
-  canvas_create_texture(GL_TEXTURE0,  "img/w.ppm",      TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE1,  "img/b.ppm",      TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE2,  "img/street.ppm", TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE3,  "img/grass.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE4,  "img/bush.ppm",   TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE5,  "img/tree.ppm",   TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE6,  "img/car.ppm",    TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE7,  "img/car-1.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE8,  "img/car-2.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE9,  "img/car-3.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE10, "img/car-4.ppm",  TEXTURE_DEFAULT);
-  canvas_create_texture(GL_TEXTURE11, "img/car-5.ppm",  TEXTURE_DEFAULT);
+  TextureRegistry* textures = registry_create(loader);
+  Texture* white = registry_texture(textures, GL_TEXTURE0, "img/w.ppm", TEXTURE_DEFAULT);
+  Texture* black = registry_texture(textures, GL_TEXTURE1, "img/b.ppm", TEXTURE_DEFAULT);
+  Texture* array = registry_texture_array(textures, GL_TEXTURE2, layers, sizeof(layers) / sizeof(layers[0]), t_keyed);
+
+  MaterialTable* table = table_create();
+  for (u16 l = 0; l < sizeof(layers) / sizeof(layers[0]); l++) table_add(table, array, l, white, 0, black, 0);
 
-  shader = shader_create_program("shd/obj.v", "shd/obj.f");
+  shader = shader_create_variants("shd/obj.v", "shd/obj.f", table_defines(table));
+  table_attach(table, shader);
 
-  generate_proj_mat(&cam, shader);
-  generate_view_mat(&cam, shader);
+  generate_proj_mat(&cam);
+  generate_view_mat(&cam);
+  canvas_set_fog(90, 0.05, 0.05, 0.08);
 
-  canvas_set_pnt_lig(shader, light, 0);
+  canvas_set_pnt_lig(light, 0);
 
   init_car(0);
   init_car(1);
@@ -270,6 +292,10 @@ void main() {
 
   while (!glfwWindowShouldClose(cam.window)) {
     update_fps(&fps, &tick);
+    if (FRAME_STATS) PRINT("%5.0f fps %4u uniform lookups, uniforms %4u sent %4u skipped, binds %4u made %4u skipped", fps, canvas_frame.uniform_lookups,
+                           canvas_frame.uniforms_issued, canvas_frame.uniforms_skipped, canvas_frame.binds_issued, canvas_frame.binds_skipped);
+    loader_upload(loader, UPLOAD_BUDGET);
+    table_update(table);
 
     glBindFramebuffer(GL_FRAMEBUFFER, drive_fbo);
     for (u8 s = 0; s < LOADED_SCENARIOS; s++) {
@@ -283,11 +309,11 @@ void main() {
 
       model_bind(trees, shader, 1);
       glm_translate(trees->model, (vec3) { p_car.x, 0, scenario_offset - (SCENARIO_SIZE * s) });
-      model_draw(trees, shader);
+      model_draw_visible(trees, shader, &cam);
 
       model_bind(bushes, shader, 1);
       glm_translate(bushes->model, (vec3) { p_car.x, 0, scenario_offset - (SCENARIO_SIZE * s) });
-      model_draw(bushes, shader);
+      model_draw_visible(bushes, shader, &cam);
     }
 
     for (u8 c = 0; c < 2; c++) {
@@ -305,7 +331,7 @@ void main() {
     model_draw(car, shader);
 
     glBindFramebuffer(GL_FRAMEBUFFER, tetris_fbo);
-    use_screen_space(&cam, shader, 1);
+    use_screen_space(1);
 
     for (u8 x = dropping_x; x < dropping_x + piece_w; x++) {
       model_bind(cube, shader, 1);
@@ -332,7 +358,7 @@ void main() {
         model_draw(cube, shader);
       }
 
-    use_screen_space(&cam, shader, 0);
+    use_screen_space(0);
 
     glBlitNamedFramebuffer(drive_fbo, lowres_fbo, 0, 0, cam.width * 0.6, cam.height, 0, 0, cam.width * 0.6 * UPSCALE, cam.height * UPSCALE, GL_COLOR_BUFFER_BIT, GL_NEAREST);
     glBlitNamedFramebuffer(lowres_fbo, drive_fbo, 0, 0, cam.width * 0.6 * UPSCALE, cam.height * UPSCALE, 0, 0, cam.width * 0.6, cam.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
@@ -355,5 +381,11 @@ void main() {
     glClearColor(1.00, 0.85, 0.35, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   }
+  loader_destroy(loader);
+  if (TEXTURE_STATS) registry_stats(textures);
+  if (SHADER_STATS) shader_cache_stats();
+  table_destroy(table);
+  registry_destroy(textures);
+  blocks_destroy();
   glfwTerminate();
 }
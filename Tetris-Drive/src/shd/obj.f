@@ -1,20 +1,45 @@
 #version 330 core
 
-#define DIR_LIG_ENABLE 0
-#define PNT_LIG_ENABLE 1
-#define SPT_LIG_ENABLE 0
-
-#define DIR_LIG_AMOUNT 1
-#define PNT_LIG_AMOUNT 1
-#define SPT_LIG_AMOUNT 1
+// Variants define LIT, TEXTURED, ALPHA_TEST, TABLE and the light amounts
+
+#ifndef DIR_LIG_AMOUNT
+#define DIR_LIG_AMOUNT 0
+#endif
+#ifndef PNT_LIG_AMOUNT
+#define PNT_LIG_AMOUNT 0
+#endif
+#ifndef SPT_LIG_AMOUNT
+#define SPT_LIG_AMOUNT 0
+#endif
+#ifndef ALPHA_KEY
+#define ALPHA_KEY vec3(0, 1, 0)
+#endif
+
+#define LIG_AMOUNT 8
+#define MAT_AMOUNT 256
+
+#define TABLE_SIZE 64
 
 // --- Struct
 
 struct Material {
-  vec3 COL;
-  sampler2D S_DIF, S_SPC, S_EMT;
+  vec3  COL;
   float SHI, AMB, DIF, SPC;
-  int LIG, PNG, TEX;
+  int   LIG, PNG, TEX, ENT;
+};
+
+struct Maps {
+  sampler2D S_DIF, S_SPC, S_EMT;
+  int IDX;
+};
+
+struct Slot {
+  uvec2 HANDLE;
+  int   LAYER, KIND;
+};
+
+struct Entry {
+  Slot MAPS[3];
 };
 
 struct DirLig {
@@ -22,22 +47,45 @@ struct DirLig {
 };
 
 struct PntLig {
-  vec3  COL, POS;
-  float CON, LIN, QUA;
+  vec3  COL;
+  float CON;
+  vec3  POS;
+  float LIN, QUA;
 };
 
 struct SptLig {
-  vec3  COL, POS, DIR;
-  float CON, LIN, QUA, INN, OUT;
+  vec3  COL;
+  float CON;
+  vec3  POS;
+  float LIN;
+  vec3  DIR;
+  float QUA, INN, OUT;
 };
 
 // --- Setup
 
-uniform vec3 CAM;
-uniform Material MAT;
-uniform DirLig DIR_LIGS[DIR_LIG_AMOUNT];
-uniform PntLig PNT_LIGS[PNT_LIG_AMOUNT];
-uniform SptLig SPT_LIGS[SPT_LIG_AMOUNT];
+layout(std140) uniform FRAME {
+  mat4  VIEW, PROJ;
+  vec3  CAM;
+  float FOG_DIST;
+  vec3  FOG_COL;
+};
+layout(std140) uniform MATERIALS {
+  Material MATS[MAT_AMOUNT];
+};
+layout(std140) uniform LIGHTS {
+  int    DIR_LIG_COUNT, PNT_LIG_COUNT, SPT_LIG_COUNT;
+  DirLig DIR_LIGS[LIG_AMOUNT];
+  PntLig PNT_LIGS[LIG_AMOUNT];
+  SptLig SPT_LIGS[LIG_AMOUNT];
+};
+uniform Maps MAT;
+layout(std140) uniform MATERIAL_TABLE {
+  Entry ENTRIES[TABLE_SIZE];
+};
+#ifndef BINDLESS
+uniform sampler2DArray LAYERS;
+#endif
 
 in float dep;
 in  vec3 nrm;
@@ -45,21 +93,40 @@ in  vec3 pos;
 in  vec2 tex;
 out vec4 color;
 
+Material MATERIAL;
+vec4 DIF_MAP;
+vec3 SPC_MAP, EMT_MAP;
+
 // --- Function
 
+vec4 Map(int map, sampler2D unit) {
+#ifndef TABLE
+  return texture(unit, tex);
+#else
+  Slot slot = ENTRIES[MATERIAL.ENT - 1].MAPS[map];
+  if (slot.KIND == 0) return vec4((uvec4(slot.HANDLE.x) >> uvec4(0, 8, 16, 24)) & 255u) / 255;
+#ifdef BINDLESS
+  if (slot.KIND == 1) return texture(sampler2D(slot.HANDLE), tex);
+  return texture(sampler2DArray(slot.HANDLE), vec3(tex, slot.LAYER));
+#else
+  return texture(LAYERS, vec3(tex, slot.LAYER));
+#endif
+#endif
+}
+
 vec3 CalcDirLig(DirLig lig, vec3 normal, vec3 cam) {
   vec3 view_dir = normalize(cam - pos);
   vec3 light_dir = normalize(-lig.DIR);
 
-  vec3 ambient = lig.COL * MAT.COL * MAT.AMB;
-  ambient *= vec3(texture(MAT.S_DIF, tex));
-  ambient += vec3(texture(MAT.S_EMT, tex));
+  vec3 ambient = lig.COL * MATERIAL.COL * MATERIAL.AMB;
+  ambient *= vec3(DIF_MAP);
+  ambient += EMT_MAP;
 
-  vec3 diffuse = lig.COL * MAT.COL * MAT.DIF * max(dot(normal, light_dir), 0); 
-  diffuse *= vec3(texture(MAT.S_DIF, tex));
+  vec3 diffuse = lig.COL * MATERIAL.COL * MATERIAL.DIF * max(dot(normal, light_dir), 0); 
+  diffuse *= vec3(DIF_MAP);
 
-  vec3 specular = lig.COL * MAT.COL * MAT.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MAT.SHI);
-  specular *= vec3(texture(MAT.S_SPC, tex));
+  vec3 specular = lig.COL * MATERIAL.COL * MATERIAL.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MATERIAL.SHI);
+  specular *= SPC_MAP;
 
   return (ambient + diffuse + specular);
 }
@@ -71,15 +138,15 @@ vec3 CalcPntLig(PntLig lig, vec3 normal, vec3 cam, vec3 frag_pos) {
   float distance = length(lig.POS - frag_pos);
   float attenuation = 1 / (lig.CON + lig.LIN * distance + lig.QUA * distance * distance);
 
-  vec3 ambient = attenuation * lig.COL * MAT.COL * MAT.AMB;
-  ambient *= vec3(texture(MAT.S_DIF, tex));
-  ambient += vec3(texture(MAT.S_EMT, tex));
+  vec3 ambient = attenuation * lig.COL * MATERIAL.COL * MATERIAL.AMB;
+  ambient *= vec3(DIF_MAP);
+  ambient += EMT_MAP;
 
-  vec3 diffuse = attenuation * lig.COL * MAT.COL * MAT.DIF * max(dot(normalize(normal), light_dir), 0); 
-  diffuse *= vec3(texture(MAT.S_DIF, tex));
+  vec3 diffuse = attenuation * lig.COL * MATERIAL.COL * MATERIAL.DIF * max(dot(normalize(normal), light_dir), 0); 
+  diffuse *= vec3(DIF_MAP);
 
-  vec3 specular = attenuation * lig.COL * MAT.COL * MAT.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MAT.SHI);
-  specular *= vec3(texture(MAT.S_SPC, tex));
+  vec3 specular = attenuation * lig.COL * MATERIAL.COL * MATERIAL.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MATERIAL.SHI);
+  specular *= SPC_MAP;
 
   return (ambient + diffuse + specular);
 }
@@ -95,15 +162,15 @@ vec3 CalcSptLig(SptLig lig, vec3 normal, vec3 cam, vec3 frag_pos) {
   float distance = length(lig.POS - frag_pos);
   float attenuation = 1 / (lig.CON + lig.LIN * distance + lig.QUA * distance * distance);
 
-  vec3 ambient = attenuation * lig.COL * MAT.COL * MAT.AMB;
-  ambient *= vec3(texture(MAT.S_DIF, tex));
-  ambient += vec3(texture(MAT.S_EMT, tex));
+  vec3 ambient = attenuation * lig.COL * MATERIAL.COL * MATERIAL.AMB;
+  ambient *= vec3(DIF_MAP);
+  ambient += EMT_MAP;
 
-  vec3 diffuse = intensity * attenuation * lig.COL * MAT.COL * MAT.DIF * max(dot(normalize(normal), light_dir), 0); 
-  diffuse *= vec3(texture(MAT.S_DIF, tex));
+  vec3 diffuse = intensity * attenuation * lig.COL * MATERIAL.COL * MATERIAL.DIF * max(dot(normalize(normal), light_dir), 0); 
+  diffuse *= vec3(DIF_MAP);
 
-  vec3 specular = intensity * attenuation * lig.COL * MAT.COL * MAT.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MAT.SHI);
-  specular *= vec3(texture(MAT.S_SPC, tex));
+  vec3 specular = intensity * attenuation * lig.COL * MATERIAL.COL * MATERIAL.SPC * pow(max(dot(view_dir, reflect(-light_dir, normal)), 0), MATERIAL.SHI);
+  specular *= SPC_MAP;
 
   return (ambient + diffuse + specular);
 }
@@ -111,37 +178,38 @@ vec3 CalcSptLig(SptLig lig, vec3 normal, vec3 cam, vec3 frag_pos) {
 // --- Main
 
 void main() {
+  MATERIAL = MATS[MAT.IDX];
+
+#if defined(LIT) || defined(TEXTURED) || defined(ALPHA_TEST)
+  DIF_MAP = Map(0, MAT.S_DIF);
+#endif
+#ifdef ALPHA_TEST
+  if (DIF_MAP.a < 0.5 || vec3(DIF_MAP) == ALPHA_KEY) discard;
+#endif
+
+#if defined(LIT)
   vec3 _color = vec3(0);
+  SPC_MAP = vec3(Map(1, MAT.S_SPC));
+  EMT_MAP = vec3(Map(2, MAT.S_EMT));
 
-  if (MAT.PNG == 1 && vec3(texture(MAT.S_DIF, tex)) == vec3(0, 1, 0)) {
-  discard;
-  }
-  if (MAT.LIG == 0) {
-    if (DIR_LIG_ENABLE == 1)
   for (int i = 0; i < DIR_LIG_AMOUNT; i++)
     _color += CalcDirLig(DIR_LIGS[i], nrm, CAM);
 
-    if (PNT_LIG_ENABLE == 1)
   for (int i = 0; i < PNT_LIG_AMOUNT; i++)
     _color += CalcPntLig(PNT_LIGS[i], nrm, CAM, pos);
 
-    if (SPT_LIG_ENABLE == 1)
   for (int i = 0; i < SPT_LIG_AMOUNT; i++)
     _color += CalcSptLig(SPT_LIGS[i], nrm, CAM, pos);
+#elif defined(TEXTURED)
+  vec3 _color = vec3(DIF_MAP);
+#else
+  vec3 _color = MATERIAL.COL;
+#endif
+
+  if (FOG_DIST > 0) {
+    float fog_factor = (FOG_DIST - dep) / (FOG_DIST - 0.1);
+    fog_factor = clamp(fog_factor, 0.0, 1.0);
+    _color = mix(FOG_COL, _color, fog_factor);
   }
-  else {
-    if (MAT.TEX == 1) {
-  _color = vec3(texture(MAT.S_DIF, tex));
-    }
-  else {
-    _color = MAT.COL;
-  }
-  }
-
-  float fog_maxdist = 90;
-  float fog_factor = (fog_maxdist - dep) / (fog_maxdist - 0.1);
-  fog_factor = clamp(fog_factor, 0.0, 1.0);
-
-  _color = mix(vec3(0.05, 0.05, 0.08), _color, fog_factor);
   color = vec4(_color, 1);
 }
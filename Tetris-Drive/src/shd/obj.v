@@ -1,12 +1,21 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNrm;
-layout (location = 2) in vec2 aTex;
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec4 inNrm;
+layout (location = 2) in vec2 inTex;
 
 uniform mat4 MODEL;
-uniform mat4 VIEW;
-uniform mat4 PROJ;
+layout(std140) uniform FRAME {
+  mat4  VIEW, PROJ;
+  vec3  CAM;
+  float FOG_DIST;
+  vec3  FOG_COL;
+};
+uniform int  PACKED;
+uniform vec3 PACKED_POS_CEN;
+uniform vec3 PACKED_POS_EXT;
+uniform vec2 PACKED_TEX_MIN;
+uniform vec2 PACKED_TEX_EXT;
 uniform int TEX_CELLS = 1;
 uniform int TEX_ACTIVE_CELL;
 uniform int TEX_KEEP_ORIENTATION;
@@ -16,7 +25,17 @@ out vec3 nrm;
 out vec2 tex;
 out float dep;
 
+vec3 oct_decode(vec2 e) {
+  vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+  if (n.z < 0) n.xy = (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+  return normalize(n);
+}
+
 void main() {
+  vec3 aPos = PACKED == 1 ? PACKED_POS_CEN + inPos / 32767 * PACKED_POS_EXT : inPos;
+  vec3 aNrm = PACKED == 1 ? oct_decode(inNrm.xy / 511) : inNrm.xyz;
+  vec2 aTex = PACKED == 1 ? PACKED_TEX_MIN + inTex / 65535 * PACKED_TEX_EXT : inTex;
+
   pos = vec3(MODEL * vec4(aPos, 1));
   gl_Position = PROJ * VIEW * MODEL * vec4(aPos, 1);
   dep = gl_Position.z;